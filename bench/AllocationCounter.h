@@ -0,0 +1,62 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+// Replaces the global operator new and delete so that a benchmark can count
+// heap allocations. The count is kept per thread, so a benchmark reading it
+// around Server calls sees only what the calling thread allocated, not what
+// a Client's I/O thread happened to allocate meanwhile. The replacements are
+// defined here rather than declared, so include this from exactly one
+// translation unit of a benchmark.
+
+
+#ifndef NETWORKING_BENCH_ALLOCATION_COUNTER_H
+#define NETWORKING_BENCH_ALLOCATION_COUNTER_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+
+namespace bench {
+
+
+inline thread_local uint64_t threadAllocations = 0;
+
+
+/** Heap allocations made so far by the calling thread. */
+inline uint64_t
+allocationsOnThisThread() noexcept {
+  return threadAllocations;
+}
+
+
+}
+
+
+void*
+operator new(std::size_t size) {
+  ++bench::threadAllocations;
+  if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+    return memory;
+  }
+  throw std::bad_alloc{};
+}
+
+
+void
+operator delete(void* memory) noexcept {
+  std::free(memory);
+}
+
+
+void
+operator delete(void* memory, std::size_t /*size*/) noexcept {
+  std::free(memory);
+}
+
+
+#endif
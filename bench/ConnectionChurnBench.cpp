@@ -0,0 +1,82 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+// Counts the heap allocations the server makes per websocket connection
+// while clients repeatedly connect and disconnect. Only allocations the
+// main thread makes inside Server calls are counted, so the clients' own
+// work does not show up, even on an I/O thread of their own.
+// The first rounds are excluded, since they fill the server's pools.
+
+
+#include "AllocationCounter.h"
+#include "Client.h"
+#include "Server.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+using networking::Client;
+using networking::Connection;
+using networking::Server;
+
+
+static constexpr int WARMUP_ROUNDS = 5;
+static constexpr int ROUNDS = 50;
+static constexpr size_t CLIENTS_PER_ROUND = 16;
+
+
+int
+main() {
+  size_t connects = 0;
+  size_t disconnects = 0;
+  Server server{0, "",
+                [&](Connection) { ++connects; },
+                [&](Connection) { ++disconnects; }};
+  const std::string port = std::to_string(server.getPort());
+
+  uint64_t counted = 0;
+  auto updateServer = [&](bool measured) {
+    const uint64_t before = bench::allocationsOnThisThread();
+    server.update();
+    if (measured) {
+      counted += bench::allocationsOnThisThread() - before;
+    }
+  };
+
+  for (int round = 0; round < WARMUP_ROUNDS + ROUNDS; ++round) {
+    const bool measured = round >= WARMUP_ROUNDS;
+    std::vector<std::unique_ptr<Client>> clients;
+    for (size_t i = 0; i < CLIENTS_PER_ROUND; ++i) {
+      clients.push_back(std::make_unique<Client>("localhost", port));
+    }
+    while (connects < (round + 1) * CLIENTS_PER_ROUND) {
+      updateServer(measured);
+      for (auto& client : clients) {
+        client->update();
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    clients.clear();
+    while (disconnects < connects) {
+      updateServer(measured);
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  const double perConnection =
+    static_cast<double>(counted) / (ROUNDS * CLIENTS_PER_ROUND);
+  std::printf("%d rounds of %zu clients connecting and disconnecting\n",
+              ROUNDS, CLIENTS_PER_ROUND);
+  std::printf("server allocations per connection: %.2f\n", perConnection);
+  return 0;
+}
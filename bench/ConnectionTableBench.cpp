@@ -0,0 +1,140 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+// Compares the Server's connection registry, a generational SlotMap, against
+// the unordered_map it replaced. Opening 100k real sockets is beyond most
+// machines' descriptor limits, so this drives the tables directly with the
+// access patterns of Server::send() (a lookup per message) and
+// Server::broadcast() (a walk over every connection), after enough churn that
+// neither table is freshly built.
+
+
+#include "SlotMap.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+
+using networking::SlotMap;
+
+using Clock = std::chrono::steady_clock;
+
+
+// Stands in for a Channel. Only the pointer chase matters here.
+struct FakeChannel {
+  uint64_t sent = 0;
+};
+
+
+static constexpr int PASSES = 20;
+
+
+struct Timings {
+  double lookupNs;
+  double iterateNs;
+};
+
+
+template <typename Body>
+static double
+nanosecondsPer(size_t operations, Body&& body) {
+  const auto start = Clock::now();
+  for (int pass = 0; pass < PASSES; ++pass) {
+    body();
+  }
+  const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+  return elapsed.count() / static_cast<double>(operations * PASSES);
+}
+
+
+static Timings
+measureUnorderedMap(size_t connections, std::mt19937& random) {
+  std::unordered_map<uintptr_t, std::shared_ptr<FakeChannel>> table;
+  std::vector<uintptr_t> live;
+  uintptr_t nextId = 1;
+  for (size_t i = 0; i < connections; ++i) {
+    table.emplace(nextId, std::make_shared<FakeChannel>());
+    live.push_back(nextId++);
+  }
+  // Replace a tenth of the connections, as clients come and go.
+  std::shuffle(live.begin(), live.end(), random);
+  for (size_t i = 0; i < connections / 10; ++i) {
+    table.erase(live[i]);
+    table.emplace(nextId, std::make_shared<FakeChannel>());
+    live[i] = nextId++;
+  }
+  std::shuffle(live.begin(), live.end(), random);
+
+  Timings timings{};
+  timings.lookupNs = nanosecondsPer(live.size(), [&] {
+    for (auto id : live) {
+      if (auto found = table.find(id); found != table.end()) {
+        ++found->second->sent;
+      }
+    }
+  });
+  timings.iterateNs = nanosecondsPer(table.size(), [&] {
+    for (auto& [id, channel] : table) {
+      ++channel->sent;
+    }
+  });
+  return timings;
+}
+
+
+static Timings
+measureSlotMap(size_t connections, std::mt19937& random) {
+  SlotMap<std::shared_ptr<FakeChannel>> table;
+  std::vector<uintptr_t> live;
+  for (size_t i = 0; i < connections; ++i) {
+    live.push_back(table.insert(std::make_shared<FakeChannel>()));
+  }
+  std::shuffle(live.begin(), live.end(), random);
+  for (size_t i = 0; i < connections / 10; ++i) {
+    table.erase(live[i]);
+    live[i] = table.insert(std::make_shared<FakeChannel>());
+  }
+  std::shuffle(live.begin(), live.end(), random);
+
+  Timings timings{};
+  timings.lookupNs = nanosecondsPer(live.size(), [&] {
+    for (auto id : live) {
+      if (auto* channel = table.find(id)) {
+        ++(*channel)->sent;
+      }
+    }
+  });
+  timings.iterateNs = nanosecondsPer(table.size(), [&] {
+    for (auto& channel : table.getValues()) {
+      ++channel->sent;
+    }
+  });
+  return timings;
+}
+
+
+int
+main() {
+  std::mt19937 random{42};
+  std::printf("%-10s %-14s %14s %14s\n",
+              "conns", "table", "lookup ns/op", "iterate ns/op");
+  for (size_t connections : {size_t{10'000}, size_t{100'000}}) {
+    const auto map = measureUnorderedMap(connections, random);
+    const auto slots = measureSlotMap(connections, random);
+    std::printf("%-10zu %-14s %14.2f %14.2f\n",
+                connections, "unordered_map", map.lookupNs, map.iterateNs);
+    std::printf("%-10zu %-14s %14.2f %14.2f\n",
+                connections, "SlotMap", slots.lookupNs, slots.iterateNs);
+  }
+  return 0;
+}
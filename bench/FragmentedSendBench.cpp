@@ -0,0 +1,171 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+// Measures how long a client's ping waits for its pong while the server
+// streams large messages to that client, once with every message written as
+// a single frame and once with messages split into fragments. The pong can
+// only go out between frames, so without fragments it waits for the rest of
+// the message being written. The client is a bare Beast websocket, since
+// networking::Client does not expose pings.
+
+
+#include "Server.h"
+
+#include <boost/asio.hpp>
+#include <boost/beast.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+
+using asio::as_tuple;
+using asio::awaitable;
+using asio::use_awaitable;
+using networking::Connection;
+using networking::Message;
+using networking::Server;
+using networking::ServerOptions;
+
+using WebSocket = websocket::stream<beast::tcp_stream>;
+using Clock = std::chrono::steady_clock;
+
+
+static constexpr size_t MESSAGE_SIZE = 16 * 1024 * 1024;
+static constexpr size_t WARMUP_PINGS = 10;
+static constexpr size_t PINGS = 200;
+static constexpr auto PING_INTERVAL = std::chrono::milliseconds(2);
+
+
+// Reads and discards everything the server sends.
+static awaitable<void>
+drain(WebSocket& ws) {
+  std::array<char, 64 * 1024> chunk;
+  while (true) {
+    auto [error, bytes] =
+      co_await ws.async_read_some(asio::buffer(chunk), as_tuple(use_awaitable));
+    if (error) {
+      co_return;
+    }
+  }
+}
+
+
+// Keeps one ping outstanding until enough pongs have been timed, then
+// closes the socket, which also ends drain().
+static awaitable<void>
+pingRepeatedly(WebSocket& ws,
+               std::optional<Clock::time_point>& outstanding,
+               const std::vector<std::chrono::nanoseconds>& samples) {
+  asio::steady_timer timer{co_await asio::this_coro::executor};
+  while (samples.size() < WARMUP_PINGS + PINGS) {
+    if (!outstanding) {
+      outstanding = Clock::now();
+      auto [error] = co_await ws.async_ping({}, as_tuple(use_awaitable));
+      if (error) {
+        co_return;
+      }
+    }
+    timer.expires_after(PING_INTERVAL);
+    co_await timer.async_wait(as_tuple(use_awaitable));
+  }
+  beast::get_lowest_layer(ws).close();
+}
+
+
+static std::vector<std::chrono::nanoseconds>
+measure(size_t sendFragmentBytes) {
+  ServerOptions options;
+  options.sendFragmentBytes = sendFragmentBytes;
+  std::optional<Connection> connection;
+  Server server{0, "",
+                [&](Connection c) { connection = c; },
+                [](Connection) { },
+                options};
+  const std::string port = std::to_string(server.getPort());
+
+  // Keeps one large message queued behind the one being written.
+  std::atomic<bool> done = false;
+  std::thread streamer{[&] {
+    const std::string payload(MESSAGE_SIZE, 'x');
+    while (!done.load(std::memory_order_relaxed)) {
+      server.update(std::chrono::milliseconds(1));
+      if (connection && server.queueDepth(*connection).messages == 0) {
+        server.send(std::deque<Message>{Message{*connection, payload}});
+      }
+    }
+  }};
+
+  asio::io_context io;
+  WebSocket ws{io};
+  asio::ip::tcp::resolver resolver{io};
+  beast::get_lowest_layer(ws).connect(resolver.resolve("127.0.0.1", port));
+  ws.read_message_max(0);
+  ws.handshake("localhost", "/");
+
+  std::vector<std::chrono::nanoseconds> samples;
+  samples.reserve(WARMUP_PINGS + PINGS);
+  std::optional<Clock::time_point> outstanding;
+  ws.control_callback([&](websocket::frame_type kind, beast::string_view) {
+    if (kind == websocket::frame_type::pong && outstanding) {
+      samples.push_back(Clock::now() - *outstanding);
+      outstanding.reset();
+    }
+  });
+
+  asio::co_spawn(io, drain(ws), asio::detached);
+  asio::co_spawn(io, pingRepeatedly(ws, outstanding, samples), asio::detached);
+  io.run();
+
+  done = true;
+  streamer.join();
+  samples.erase(samples.begin(),
+                samples.begin() + std::min(samples.size(), WARMUP_PINGS));
+  return samples;
+}
+
+
+static void
+report(const char* label, std::vector<std::chrono::nanoseconds> samples) {
+  if (samples.empty()) {
+    std::printf("%-18s no pongs received\n", label);
+    return;
+  }
+  std::sort(samples.begin(), samples.end());
+  auto micros = [](std::chrono::nanoseconds value) {
+    return std::chrono::duration<double, std::micro>(value).count();
+  };
+  std::printf("%-18s p50 %9.1f us   p99 %9.1f us   max %9.1f us\n",
+              label,
+              micros(samples[samples.size() / 2]),
+              micros(samples[samples.size() * 99 / 100]),
+              micros(samples.back()));
+}
+
+
+int
+main() {
+  auto whole = measure(0);
+  auto fragmented = measure(64 * 1024);
+
+  std::printf("ping round trips during %zu MiB messages\n",
+              MESSAGE_SIZE / (1024 * 1024));
+  report("single frames", std::move(whole));
+  report("64 KiB fragments", std::move(fragmented));
+  return 0;
+}
@@ -0,0 +1,126 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+// Compares the round trip latency of small websocket messages over loopback
+// TCP and over a Unix domain socket. The server echoes on its own thread and
+// the client runs its I/O on a background thread, so each round trip crosses
+// the transport twice and wakes both sides once.
+
+
+#include "Client.h"
+#include "Server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+using networking::Client;
+using networking::ClientOptions;
+using networking::Connection;
+using networking::Server;
+using networking::ServerOptions;
+
+
+static constexpr int WARMUP_ROUND_TRIPS = 1000;
+static constexpr int ROUND_TRIPS = 20000;
+
+
+static std::vector<std::chrono::nanoseconds>
+measure(Client& client) {
+  std::vector<std::chrono::nanoseconds> samples;
+  samples.reserve(ROUND_TRIPS);
+  const std::string payload(64, 'x');
+  for (int i = 0; i < WARMUP_ROUND_TRIPS + ROUND_TRIPS; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    client.send(payload);
+    std::string reply;
+    while (reply.empty() && !client.isDisconnected()) {
+      client.update(std::chrono::milliseconds(100));
+      reply = client.receive();
+    }
+    if (i >= WARMUP_ROUND_TRIPS) {
+      samples.push_back(std::chrono::steady_clock::now() - start);
+    }
+  }
+  return samples;
+}
+
+
+static void
+report(const char* transport, std::vector<std::chrono::nanoseconds> samples) {
+  std::sort(samples.begin(), samples.end());
+  std::chrono::nanoseconds total{0};
+  for (auto sample : samples) {
+    total += sample;
+  }
+  auto micros = [](std::chrono::nanoseconds value) {
+    return std::chrono::duration<double, std::micro>(value).count();
+  };
+  std::printf("%-6s mean %7.1f us   p50 %7.1f us   p99 %7.1f us\n",
+              transport,
+              micros(total / static_cast<long>(samples.size())),
+              micros(samples[samples.size() / 2]),
+              micros(samples[samples.size() * 99 / 100]));
+}
+
+
+int
+main() {
+  const auto path =
+    std::filesystem::temp_directory_path() / "networking-latency-bench.sock";
+
+  ServerOptions options;
+  options.unixSocket = path;
+  Server server{0, "",
+                [](Connection) { },
+                [](Connection) { },
+                options};
+  const std::string port = std::to_string(server.getPort());
+
+  std::atomic<bool> done = false;
+  std::thread echo{[&] {
+    while (!done.load(std::memory_order_relaxed)) {
+      server.update(std::chrono::milliseconds(1));
+      auto messages = server.receive();
+      if (!messages.empty()) {
+        server.send(messages);
+        server.recycle(std::move(messages));
+      }
+    }
+  }};
+
+  ClientOptions tcpOptions;
+  tcpOptions.ioThread = true;
+  ClientOptions unixOptions = tcpOptions;
+  unixOptions.unixSocket = path;
+
+  std::vector<std::chrono::nanoseconds> tcp;
+  std::vector<std::chrono::nanoseconds> local;
+  {
+    Client client{"localhost", port, tcpOptions};
+    tcp = measure(client);
+  }
+  {
+    Client client{"localhost", port, unixOptions};
+    local = measure(client);
+  }
+
+  done = true;
+  echo.join();
+
+  std::printf("%d round trips of 64 byte messages\n", ROUND_TRIPS);
+  report("tcp", std::move(tcp));
+  report("unix", std::move(local));
+  return 0;
+}
@@ -0,0 +1,128 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+// Measures how long small updates take to reach a client whose connection
+// is congested with bulk transfers. The server keeps several 1 MiB Bulk
+// messages queued at all times and sends a timestamped update every few
+// milliseconds, first in the Bulk lane, which is how a single FIFO queue
+// would treat it, and then at Realtime priority. The client runs in the
+// same process, so the latency is read off the same clock.
+
+
+#include "Client.h"
+#include "Server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+using networking::Client;
+using networking::ClientOptions;
+using networking::Connection;
+using networking::Message;
+using networking::Priority;
+using networking::Server;
+using Clock = std::chrono::steady_clock;
+
+
+static constexpr size_t BULK_SIZE = 1024 * 1024;
+static constexpr size_t BULK_QUEUED = 8;
+static constexpr size_t UPDATES = 300;
+static constexpr auto UPDATE_INTERVAL = std::chrono::milliseconds(5);
+
+
+static std::vector<std::chrono::nanoseconds>
+measure(Priority updatePriority) {
+  std::optional<Connection> connection;
+  Server server{0, "", [&](Connection c) { connection = c; }, [](Connection) { }};
+  const std::string port = std::to_string(server.getPort());
+
+  std::atomic<bool> done = false;
+  std::thread sender{[&] {
+    const std::vector<std::byte> bulk(BULK_SIZE);
+    auto nextUpdate = Clock::now();
+    while (!done.load(std::memory_order_relaxed)) {
+      server.update(std::chrono::milliseconds(1));
+      if (!connection) {
+        continue;
+      }
+      while (server.queueDepth(*connection).messages < BULK_QUEUED) {
+        server.send(*connection, bulk, Priority::Bulk);
+      }
+      if (Clock::now() >= nextUpdate) {
+        nextUpdate += UPDATE_INTERVAL;
+        Message update{*connection,
+          std::to_string(Clock::now().time_since_epoch().count()) + ";"};
+        update.priority = updatePriority;
+        server.send(std::deque<Message>{std::move(update)});
+      }
+    }
+  }};
+
+  ClientOptions options;
+  options.ioThread = true;
+  std::vector<std::chrono::nanoseconds> samples;
+  {
+    Client client{"localhost", port, options};
+    while (samples.size() < UPDATES && !client.isDisconnected()) {
+      client.update(std::chrono::milliseconds(100));
+      const auto received = Clock::now();
+      std::istringstream updates{client.receive()};
+      std::string stamp;
+      while (std::getline(updates, stamp, ';')) {
+        const Clock::time_point sent{Clock::duration{std::stoll(stamp)}};
+        samples.push_back(received - sent);
+      }
+      // Discard the bulk messages, which only exist to congest the link.
+      (void)client.receiveBinary();
+    }
+  }
+
+  done = true;
+  sender.join();
+  return samples;
+}
+
+
+static void
+report(const char* label, std::vector<std::chrono::nanoseconds> samples) {
+  if (samples.empty()) {
+    std::printf("%-9s no updates received\n", label);
+    return;
+  }
+  std::sort(samples.begin(), samples.end());
+  auto millis = [](std::chrono::nanoseconds value) {
+    return std::chrono::duration<double, std::milli>(value).count();
+  };
+  std::printf("%-9s p50 %8.2f ms   p99 %8.2f ms   max %8.2f ms\n",
+              label,
+              millis(samples[samples.size() / 2]),
+              millis(samples[samples.size() * 99 / 100]),
+              millis(samples.back()));
+}
+
+
+int
+main() {
+  auto fifo = measure(Priority::Bulk);
+  auto realtime = measure(Priority::Realtime);
+
+  std::printf("%zu updates behind %zu queued %zu KiB bulk messages\n",
+              UPDATES, BULK_QUEUED, BULK_SIZE / 1024);
+  report("fifo", std::move(fifo));
+  report("realtime", std::move(realtime));
+  return 0;
+}
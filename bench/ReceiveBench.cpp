@@ -0,0 +1,97 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+// Counts the heap allocations the server side of a game-style tick makes
+// when messages are taken with receive() versus receiveInto(). Each tick, a
+// client sends a burst of messages and the server updates until it has
+// received all of them. Only allocations the main thread makes inside
+// Server calls are counted, so the client's own work does not show up, even
+// on an I/O thread of its own.
+
+
+#include "AllocationCounter.h"
+#include "Client.h"
+#include "Server.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+using networking::Client;
+using networking::Connection;
+using networking::Message;
+using networking::Server;
+
+
+static constexpr int WARMUP_TICKS = 50;
+static constexpr int TICKS = 500;
+static constexpr int BURST = 32;
+static constexpr size_t MESSAGE_SIZE = 64;
+
+
+enum class Mode { Receive, ReceiveInto };
+
+
+static double
+allocationsPerTick(Mode mode) {
+  std::optional<Connection> connection;
+  Server server{0, "", [&](Connection c) { connection = c; }, [](Connection) { }};
+  Client client{"localhost", std::to_string(server.getPort())};
+  while (!connection) {
+    server.update();
+    client.update();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  const std::string payload(MESSAGE_SIZE, 'x');
+  std::vector<Message> reused;
+  uint64_t counted = 0;
+
+  for (int tick = 0; tick < WARMUP_TICKS + TICKS; ++tick) {
+    for (int i = 0; i < BURST; ++i) {
+      client.send(payload);
+    }
+    client.update();
+
+    size_t received = 0;
+    while (received < BURST) {
+      const uint64_t before = bench::allocationsOnThisThread();
+      server.update();
+      if (mode == Mode::Receive) {
+        auto messages = server.receive();
+        received += messages.size();
+        server.recycle(std::move(messages));
+      } else {
+        server.receiveInto(reused);
+        received += reused.size();
+      }
+      if (tick >= WARMUP_TICKS) {
+        counted += bench::allocationsOnThisThread() - before;
+      }
+      client.update();
+    }
+  }
+  return static_cast<double>(counted) / TICKS;
+}
+
+
+int
+main() {
+  std::printf("%d ticks of %d x %zu byte messages\n\n",
+              TICKS, BURST, MESSAGE_SIZE);
+  std::printf("%-14s %18s\n", "path", "allocations/tick");
+  std::printf("%-14s %18.2f\n", "receive", allocationsPerTick(Mode::Receive));
+  std::printf("%-14s %18.2f\n", "receiveInto",
+              allocationsPerTick(Mode::ReceiveInto));
+  return 0;
+}
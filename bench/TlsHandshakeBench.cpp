@@ -0,0 +1,99 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+// Measures how many TLS websocket connections per second one client can set
+// up, with full handshakes and with resumed sessions. Each connection also
+// exchanges one message, so that the session tickets which TLS 1.3 sends
+// after the handshake have arrived before the client goes away.
+
+
+#include "Client.h"
+#include "Server.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+
+
+using networking::Client;
+using networking::ClientOptions;
+using networking::Connection;
+using networking::Server;
+using networking::ServerOptions;
+
+
+static constexpr int WARMUP_CONNECTIONS = 20;
+static constexpr int CONNECTIONS = 500;
+
+static const std::string CERTS_DIR = NETWORKING_TEST_CERTS_DIR;
+
+
+static double
+connectionsPerSecond(Server& server, const ClientOptions& options) {
+  const std::string port = std::to_string(server.getPort());
+  auto connectOnce = [&] {
+    Client client{"localhost", port, options};
+    client.send("hello");
+    std::string reply;
+    while (reply.empty() && !client.isDisconnected()) {
+      server.update();
+      auto messages = server.receive();
+      if (!messages.empty()) {
+        server.send(messages);
+        server.recycle(std::move(messages));
+      }
+      client.update();
+      reply = client.receive();
+    }
+  };
+
+  for (int i = 0; i < WARMUP_CONNECTIONS; ++i) {
+    connectOnce();
+  }
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < CONNECTIONS; ++i) {
+    connectOnce();
+  }
+  const std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return CONNECTIONS / elapsed.count();
+}
+
+
+int
+main() {
+  ServerOptions serverOptions;
+  serverOptions.tls.enabled = true;
+  serverOptions.tls.certificateChainFile = CERTS_DIR + "/localhost.crt";
+  serverOptions.tls.privateKeyFile = CERTS_DIR + "/localhost.key";
+  Server server{0, "",
+                [](Connection) { },
+                [](Connection) { },
+                serverOptions};
+
+  ClientOptions full;
+  full.tls.enabled = true;
+  full.tls.caFile = CERTS_DIR + "/localhost.crt";
+  full.tls.sessionResumption = false;
+  ClientOptions resumed = full;
+  resumed.tls.sessionResumption = true;
+
+  const double fullRate = connectionsPerSecond(server, full);
+  const uint64_t resumedBefore = server.stats().tlsResumedHandshakes;
+  const double resumedRate = connectionsPerSecond(server, resumed);
+  const uint64_t resumedCount =
+    server.stats().tlsResumedHandshakes - resumedBefore;
+
+  std::printf("%d connections each, TLS handshake plus one echo\n",
+              CONNECTIONS);
+  std::printf("full handshakes:    %8.1f connections/s\n", fullRate);
+  std::printf("resumed handshakes: %8.1f connections/s (%llu resumed)\n",
+              resumedRate, static_cast<unsigned long long>(resumedCount));
+  return 0;
+}
@@ -0,0 +1,125 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+// Counts the write syscalls spent per message with and without write
+// coalescing, in both directions. The counts come from the `syscw` field of
+// /proc/self/io, so this is Linux only and covers every write the process
+// makes while the messages are in flight.
+
+
+#include "Client.h"
+#include "Server.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <thread>
+
+
+using networking::Client;
+using networking::ClientOptions;
+using networking::Connection;
+using networking::Message;
+using networking::Server;
+using networking::ServerOptions;
+
+
+static constexpr int ROUNDS = 200;
+static constexpr int BURST = 64;
+static constexpr size_t MESSAGE_SIZE = 48;
+
+
+static std::optional<uint64_t>
+writeSyscalls() {
+  std::ifstream io{"/proc/self/io"};
+  std::string key;
+  uint64_t value = 0;
+  while (io >> key >> value) {
+    if (key == "syscw:") {
+      return value;
+    }
+  }
+  return std::nullopt;
+}
+
+
+struct Result {
+  uint64_t serverToClient;
+  uint64_t clientToServer;
+};
+
+
+static Result
+measure(size_t writeBatchBytes) {
+  std::optional<Connection> connection;
+  Server server{0, "", [&](Connection c) { connection = c; }, [](Connection) { },
+                ServerOptions{.writeBatchBytes = writeBatchBytes}};
+  Client client{"localhost", std::to_string(server.getPort()),
+                ClientOptions{.writeBatchBytes = writeBatchBytes}};
+  while (!connection) {
+    server.update();
+    client.update();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  const std::string payload(MESSAGE_SIZE, 'x');
+  std::deque<Message> burst(BURST, Message{*connection, payload});
+  Result result{0, 0};
+
+  for (int round = 0; round < ROUNDS; ++round) {
+    const auto before = writeSyscalls().value_or(0);
+    server.send(burst);
+    size_t received = 0;
+    while (received < BURST * MESSAGE_SIZE) {
+      server.update();
+      client.update();
+      received += client.receive().size();
+    }
+    result.serverToClient += writeSyscalls().value_or(0) - before;
+  }
+
+  for (int round = 0; round < ROUNDS; ++round) {
+    const auto before = writeSyscalls().value_or(0);
+    for (int i = 0; i < BURST; ++i) {
+      client.send(payload);
+    }
+    size_t received = 0;
+    while (received < BURST) {
+      client.update();
+      server.update();
+      received += server.receive().size();
+    }
+    result.clientToServer += writeSyscalls().value_or(0) - before;
+  }
+
+  return result;
+}
+
+
+int
+main() {
+  if (!writeSyscalls()) {
+    std::fprintf(stderr, "/proc/self/io is unavailable; nothing to measure.\n");
+    return 1;
+  }
+
+  constexpr double messages = ROUNDS * BURST;
+  std::printf("%d bursts of %d x %zu byte messages per direction\n\n",
+              ROUNDS, BURST, MESSAGE_SIZE);
+  std::printf("%-22s %18s %18s\n",
+              "writeBatchBytes", "server->client", "client->server");
+  for (size_t batchBytes : {size_t{0}, size_t{64 * 1024}}) {
+    const auto [toClient, toServer] = measure(batchBytes);
+    std::printf("%-22zu %11.3f sys/msg %11.3f sys/msg\n",
+                batchBytes, toClient / messages, toServer / messages);
+  }
+  return 0;
+}
@@ -9,17 +9,104 @@
 #ifndef NETWORKING_CLIENT_H
 #define NETWORKING_CLIENT_H
 
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
 #include <memory>
+#include <span>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#include "Transport.h"
 
 
 namespace networking {
 
 
+/**
+ *  Connecting with TLS, as to a Server with TlsServerOptions. This needs a
+ *  library built with NETWORKING_ENABLE_TLS; otherwise the Client reports
+ *  itself disconnected right away.
+ */
+struct TlsClientOptions {
+  bool enabled = false;
+
+  /**
+   *  PEM file of the certificate authorities to trust. Empty trusts the
+   *  system's default ones.
+   */
+  std::filesystem::path caFile;
+
+  /**
+   *  Check the Server's certificate against the trusted authorities and
+   *  the address given to the Client. Turning this off is only meant for
+   *  testing.
+   */
+  bool verifyPeer = true;
+
+  /**
+   *  Remember the session a Server hands out and resume it on the next
+   *  connection to the same address and port, skipping the costly part of
+   *  the handshake. Sessions are shared by all Clients in the process that
+   *  check the certificate the same way, and only sessions whose
+   *  certificate was verified are kept.
+   */
+  bool sessionResumption = true;
+};
+
+
+/**
+ *  Tuning knobs for a Client. The defaults suit most uses, so they only need
+ *  to be supplied when opting into something else. Native clients honor all
+ *  of them; the browser manages its own socket, so emscripten builds ignore
+ *  them.
+ */
+struct ClientOptions {
+  /**
+   *  Upper bound in bytes on how many queued messages are framed into a
+   *  single socket write. Zero sends every message with its own write.
+   */
+  size_t writeBatchBytes = 64 * 1024;
+
+  /** permessage-deflate settings requested from the server. */
+  CompressionOptions compression;
+
+  /**
+   *  Largest message in bytes accepted from the Server, which is
+   *  disconnected if it sends a larger one. Zero removes the limit.
+   */
+  size_t maxMessageBytes = 16 * 1024 * 1024;
+
+  /**
+   *  Run the network I/O on a background thread instead of inside
+   *  Client::update(). Messages still arrive through Client::receive() on
+   *  the caller's thread, and Client::nativeHandle() becomes available for
+   *  waiting on them from an external event loop.
+   */
+  bool ioThread = false;
+
+  /** Handshake and idle deadlines for the connection to the Server. */
+  TimeoutOptions timeouts;
+
+  /**
+   *  Connect to a Server's Unix domain socket at this path instead of
+   *  resolving the address and port, which are then only used to name the
+   *  host in the handshake. See ServerOptions::unixSocket. Empty for TCP.
+   */
+  std::filesystem::path unixSocket;
+
+  /** Encryption of the connection with TLS. */
+  TlsClientOptions tls;
+};
+
+
 /**
  *  @class Client
  *
- *  @brief A single threaded network client for transferring text.
+ *  @brief A single threaded network client for transferring text and binary
+ *  messages.
  *
  *  The Client class transfers text to and from a Server running on a given
  *  IP address and port. The behavior is single threaded, so all transfer
@@ -33,7 +120,9 @@ public:
    *  Construct a Client and acquire a connection to a remote Server at the
    *  given address and port.
    */
-  Client(std::string_view address, std::string_view port);
+  Client(std::string_view address,
+         std::string_view port,
+         ClientOptions options = {});
 
   /** Out of line default constructor for compilation firewall. */
   ~Client();
@@ -49,25 +138,60 @@ public:
    */
   void update();
 
+  /**
+   *  Like Client::update(), but if nothing has been received yet, first block
+   *  for up to `maxWait` until some network activity completes. Browser builds
+   *  cannot block and behave exactly like Client::update().
+   */
+  void update(std::chrono::nanoseconds maxWait);
+
   /**
    *  Send a message to the server.
    */
   void send(std::string message);
 
   /**
-   *  Receive messages from the Server. This returns all messages collected by
-   *  previous calls to Client::update() and not yet received. If multiple
-   *  messages were received from the Server, they are first concatenated
-   *  into a single std::string.
+   *  Send a binary message to the server. The bytes are delivered as is,
+   *  without the UTF-8 validation applied to text.
+   */
+  void send(std::span<const std::byte> payload);
+
+  /**
+   *  Receive text messages from the Server. This returns all text messages
+   *  collected by previous calls to Client::update() and not yet received.
+   *  If multiple messages were received from the Server, they are first
+   *  concatenated into a single std::string.
    */
   [[nodiscard]] std::string receive();
 
+  /**
+   *  Receive binary messages from the Server. Unlike text, each message is
+   *  returned separately, in the order it arrived.
+   */
+  [[nodiscard]] std::deque<std::vector<std::byte>> receiveBinary();
+
   /**
    *  Returns true iff the client disconnected from the server after initially
    *  connecting.
    */
   [[nodiscard]] bool isDisconnected() const noexcept;
 
+  /**
+   *  Returns a file descriptor that becomes readable when messages have
+   *  arrived or the connection has closed, for folding the Client into an
+   *  external event loop such as epoll. It stays readable until the next
+   *  Client::update(). This needs ClientOptions::ioThread; otherwise, on
+   *  Windows, and in browser builds, it returns -1. The descriptor is owned
+   *  by the Client and must not be closed.
+   */
+  [[nodiscard]] int nativeHandle() const noexcept;
+
+  /**
+   *  Returns how well messages sent by this Client compressed and how much
+   *  CPU time that took. Browser builds cannot observe this and report zeros.
+   */
+  [[nodiscard]] CompressionStats compressionStats() const;
+
 private:
   class ClientImpl;
 
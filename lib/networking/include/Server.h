@@ -9,12 +9,20 @@
 #ifndef NETWORKING_SERVER_H
 #define NETWORKING_SERVER_H
 
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <deque>
+#include <filesystem>
 #include <functional>
 #include <memory>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
+
+#include "Transport.h"
 
 
 namespace networking {
@@ -30,6 +38,8 @@ static_assert(false,
 /**
  *  An identifier for a Client connected to a Server. The ID of a Connection is
  *  guaranteed to be unique across all actively connected Client instances.
+ *  IDs are opaque. Once a Client disconnects, its ID is rejected by every
+ *  Server call, even though a later Client may reuse part of its encoding.
  */
 struct Connection {
   uintptr_t id;
@@ -49,13 +59,394 @@ struct ConnectionHash {
 };
 
 
+/**
+ *  The lane an outgoing message waits in until it is written. A Connection
+ *  sends Realtime messages before anything else queued for it and Normal
+ *  messages before Bulk ones, except that Bulk gets a turn now and then as
+ *  set by ServerOptions::normalPerBulk. Messages within a lane keep their
+ *  order. A message already being written is never interrupted.
+ */
+enum class Priority : uint8_t {
+  /** Small, urgent updates such as input acknowledgements. */
+  Realtime,
+  Normal,
+  /** Large transfers that can wait, such as assets or replays. */
+  Bulk
+};
+
+
 /**
  *  A Message containing text that can be sent to or was recieved from a given
- *  Connection.
+ *  Connection. Binary messages carry arbitrary bytes in `text` and are marked
+ *  by their type.
  */
 struct Message {
   Connection connection;
   std::string text;
+  MessageType type = MessageType::Text;
+
+  /**
+   *  False for received fragments that more of the same message follows,
+   *  which only ReceiveOptions::streaming produces. Ignored when sending.
+   */
+  bool endOfMessage = true;
+
+  /** The lane the message is queued in when sent. Ignored when received. */
+  Priority priority = Priority::Normal;
+};
+
+
+/**
+ *  What a Server does when a Connection's outbound queue would exceed its
+ *  limits.
+ */
+enum class OverflowPolicy : uint8_t {
+  /**
+   *  Discard queued messages, oldest first, until the new one fits. Lower
+   *  priority lanes are emptied before higher ones.
+   */
+  DropOldest,
+  /**
+   *  Discard the newest message of the lowest priority lane, which is the
+   *  one being sent unless something of lower priority is queued, and keep
+   *  doing so until the queue is back within its limits.
+   */
+  DropNewest,
+  /** Disconnect the slow Client and discard everything queued for it. */
+  Disconnect
+};
+
+
+/**
+ *  Bounds on the messages waiting to be written to a single Connection. A
+ *  Client that stops reading would otherwise make its queue, and the
+ *  Server's memory, grow without limit. A limit of zero means unbounded.
+ */
+struct OutboundLimits {
+  size_t maxQueuedBytes = 0;
+  size_t maxQueuedMessages = 0;
+  OverflowPolicy policy = OverflowPolicy::DropOldest;
+};
+
+
+/**
+ *  How much is waiting to be written to a Connection. A message counts from
+ *  when it is queued until its write to the socket begins.
+ */
+struct QueueDepth {
+  size_t messages = 0;
+  size_t bytes = 0;
+};
+
+
+/** Traffic counters for a single Connection. Byte counts are payload bytes. */
+struct ConnectionStats {
+  uint64_t messagesIn = 0;
+  uint64_t bytesIn = 0;
+  uint64_t messagesOut = 0;
+  uint64_t bytesOut = 0;
+  QueueDepth queued;
+};
+
+
+/**
+ *  A snapshot of a Server's counters, as returned by Server::stats(). Message
+ *  and byte counts cover every Connection since the Server started,
+ *  including those that have since disconnected.
+ */
+struct ServerStats {
+  /**
+   *  TCP connections accepted, including plain HTTP requests. Connections
+   *  turned away by the AdmissionLimits are not included.
+   */
+  uint64_t acceptedConnections = 0;
+
+  /** Connections turned away for AdmissionLimits::maxConnections. */
+  uint64_t rejectedOverCapacity = 0;
+
+  /** Connections turned away by the AdmissionLimits accept rate. */
+  uint64_t rejectedOverRate = 0;
+
+  /** Accepts that failed, e.g. because the process ran out of descriptors. */
+  uint64_t acceptErrors = 0;
+
+  /**
+   *  Exceptions that escaped a connection's coroutine or an I/O thread's
+   *  event loop. The Server contains them and carries on, but any count
+   *  above zero points at a bug. ServerOptions::onError describes each one.
+   */
+  uint64_t handlerErrors = 0;
+
+  /** TLS handshakes completed, resumed ones included. */
+  uint64_t tlsHandshakes = 0;
+
+  /** TLS handshakes that resumed an earlier session, skipping the full one. */
+  uint64_t tlsResumedHandshakes = 0;
+
+  /** TLS handshakes that failed or timed out. */
+  uint64_t tlsHandshakeErrors = 0;
+
+  /** Websocket Connections currently open. */
+  uint64_t activeConnections = 0;
+
+  /** Websocket Connections that have disconnected, from either side. */
+  uint64_t closedConnections = 0;
+
+  uint64_t messagesIn = 0;
+  uint64_t bytesIn = 0;
+  uint64_t messagesOut = 0;
+  uint64_t bytesOut = 0;
+
+  /**
+   *  Messages queued by Server::sendLatest() that were replaced by a newer
+   *  one for the same key before they could be written.
+   */
+  uint64_t supersededMessages = 0;
+
+  /** Outbound queue depth summed over all active Connections. */
+  QueueDepth queued;
+
+  /** Calls to Server::update() so far. */
+  uint64_t updates = 0;
+
+  /**
+   *  Handlers run by the most recent Server::update(), and the time it spent
+   *  running them. With I/O threads, these count the events it applied
+   *  instead. Time spent blocked in update(maxWait) is not included.
+   */
+  uint64_t lastUpdateHandlers = 0;
+  std::chrono::nanoseconds lastUpdateTime{0};
+
+  /** The same as the above, summed over every Server::update(). */
+  uint64_t totalUpdateHandlers = 0;
+  std::chrono::nanoseconds totalUpdateTime{0};
+};
+
+
+/**
+ *  Limits on admitting new connections, so that a reconnect storm cannot
+ *  flood the Server with handshakes. A connection over a limit is answered
+ *  with an immediate 503 response and closed without being read. Zero
+ *  leaves the corresponding limit off.
+ */
+struct AdmissionLimits {
+  /** Most TCP connections open at once, plain HTTP ones included. */
+  size_t maxConnections = 0;
+
+  /** Connections accepted per second, sustained. */
+  double acceptsPerSecond = 0;
+
+  /** Connections that may be accepted at once above that rate. */
+  size_t acceptBurst = 64;
+
+  /** Length of the listen queue. Zero uses the system's maximum. */
+  int listenBacklog = 0;
+};
+
+
+/**
+ *  How incoming websocket messages are read. By default each one is buffered
+ *  until complete and then delivered as a single Message. Streaming instead
+ *  delivers every message in fragments as they arrive, so a large upload
+ *  neither waits until it is complete nor needs a buffer of its full size.
+ */
+struct ReceiveOptions {
+  /**
+   *  Largest incoming message in bytes. A peer sending a larger one is
+   *  disconnected as soon as the excess is noticed, with close code 1009
+   *  (message too big), and its partial message is discarded. Zero removes
+   *  the limit, which only suits streaming.
+   */
+  size_t maxMessageBytes = 16 * 1024 * 1024;
+
+  /**
+   *  Deliver messages in fragments of at most fragmentBytes. Each fragment
+   *  is a Message of its own, in order, and the last one of a message has
+   *  Message::endOfMessage set. A text fragment may end in the middle of a
+   *  multi-byte UTF-8 sequence, which the next fragment completes.
+   */
+  bool streaming = false;
+
+  /**
+   *  Most bytes per streamed fragment. Must be positive, or constructing
+   *  the Server throws.
+   */
+  size_t fragmentBytes = 64 * 1024;
+
+  /**
+   *  Most bytes per connection that may wait for receive() before the
+   *  Server stops reading from that connection. Reading resumes once
+   *  receive() has taken enough of them, and in the meantime the peer is
+   *  held back by TCP flow control. A paused connection is not heard from,
+   *  so an idle timeout may end it. Zero removes the limit.
+   */
+  size_t maxUndeliveredBytes = 64 * 1024 * 1024;
+};
+
+
+/**
+ *  Serving wss:// and https:// instead of plain websockets and HTTP, on
+ *  every listener of the Server. This needs a library built with
+ *  NETWORKING_ENABLE_TLS; otherwise enabling it makes construction throw.
+ */
+struct TlsServerOptions {
+  bool enabled = false;
+
+  /** PEM file with the Server's certificate, followed by any intermediates. */
+  std::filesystem::path certificateChainFile;
+
+  /** PEM file with the private key of that certificate. */
+  std::filesystem::path privateKeyFile;
+
+  /**
+   *  Let returning clients resume their session, through session tickets
+   *  and a server side session cache, which skips the costly part of the
+   *  handshake. Tickets are only valid for the Server that issued them.
+   */
+  bool sessionResumption = true;
+
+  /** Most sessions kept in the server side cache. */
+  size_t sessionCacheSize = 20 * 1024;
+};
+
+
+/**
+ *  Serving of a directory of static files, such as the assets of a web
+ *  client, over the Server's HTTP port. Files up to maxCachedFileBytes are
+ *  kept in memory, in an LRU cache of at most cacheBytes in total. Larger
+ *  files are streamed from disk. Responses carry a Content-Type chosen by
+ *  file extension and an ETag, and requests repeating that ETag in
+ *  If-None-Match get an empty 304 response.
+ */
+struct StaticFileOptions {
+  /** The directory to serve. Empty disables static file serving. */
+  std::filesystem::path directory;
+  size_t cacheBytes = 16 * 1024 * 1024;
+  size_t maxCachedFileBytes = 256 * 1024;
+};
+
+
+/**
+ *  Tuning knobs for a Server. The defaults give the classic single threaded
+ *  behavior, so they only need to be supplied when opting into something else.
+ */
+struct ServerOptions {
+  /**
+   *  Number of background I/O threads. With the default of zero, all network
+   *  I/O happens on the caller's thread inside Server::update(). With N > 0,
+   *  accepted connections are spread across N shards, each running its own
+   *  event loop on its own thread. Callbacks, Server::receive(), and
+   *  Server::send() still run on the thread calling Server::update(), which
+   *  sees a merged view of every shard.
+   */
+  unsigned ioThreads = 0;
+
+  /**
+   *  Upper bound in bytes on how many queued messages a connection frames
+   *  into a single socket write. Coalescing small messages this way saves a
+   *  syscall per message. Zero sends every message with its own write.
+   */
+  size_t writeBatchBytes = 64 * 1024;
+
+  /**
+   *  Largest websocket frame an outgoing message is written in. Longer
+   *  messages go out as a series of continuation frames, and between frames
+   *  the connection is free for control frames: keepalive pings, pongs
+   *  answering the peer and close. Data frames of other messages cannot be
+   *  placed between the fragments of a message, so small messages still
+   *  queue behind a large one. Zero writes every message as a single frame.
+   */
+  size_t sendFragmentBytes = 64 * 1024;
+
+  /** permessage-deflate settings offered to connecting clients. */
+  CompressionOptions compression;
+
+  /**
+   *  Number of message buffers kept for reuse by the receive path. Incoming
+   *  frames are read directly into these buffers, and Server::recycle()
+   *  returns them once the application is done with the received Messages.
+   *  Zero disables pooling.
+   */
+  size_t receiveBufferPoolSize = 1024;
+
+  /** Size limit and delivery of incoming messages. */
+  ReceiveOptions receive;
+
+  /** Per-connection bounds on queued outgoing messages. */
+  OutboundLimits outboundLimits;
+
+  /**
+   *  How many Normal priority messages a connection sends in a row while
+   *  Bulk messages are waiting, before it lets one Bulk message through.
+   *  Zero gives Normal strict priority, which can starve Bulk entirely.
+   */
+  unsigned normalPerBulk = 4;
+
+  /**
+   *  Called with the Connection and the policy that was applied whenever a
+   *  send overflows a Connection's OutboundLimits. Like the connect and
+   *  disconnect callbacks, it runs inside Server::update().
+   */
+  std::function<void(Connection, OverflowPolicy)> onOverflow;
+
+  /**
+   *  Called with a description of every failed accept and every exception
+   *  counted in ServerStats::handlerErrors. Errors can happen on any I/O
+   *  thread, so they are collected and the callback runs inside the next
+   *  Server::update(). If errors pile up faster than updates run, only the
+   *  first few per update are described; the counters still see them all.
+   */
+  std::function<void(std::string_view)> onError;
+
+  /**
+   *  How long an HTTP connection may wait for its next request, or take to
+   *  deliver one, before it is closed. Connections stay open between
+   *  requests, and may pipeline them, unless the client asks to close.
+   *  Must be positive, or constructing the Server throws.
+   */
+  std::chrono::milliseconds httpIdleTimeout{5000};
+
+  /**
+   *  Handshake and idle deadlines for websocket connections. Connections
+   *  closed by the idle timeout are reported through the disconnect
+   *  callback like any other.
+   */
+  TimeoutOptions timeouts;
+
+  /** Bounds on how many connections are admitted, and how fast. */
+  AdmissionLimits admission;
+
+  /**
+   *  Listen with SO_REUSEPORT, so that several Servers can share one port,
+   *  whether in this process on other threads or in other processes. The
+   *  kernel spreads incoming connections between them. Every listener on
+   *  the port must set this, and each Server still tracks only its own
+   *  connections. Construction throws where the system lacks SO_REUSEPORT.
+   */
+  bool reusePort = false;
+
+  /**
+   *  Listen on IPv6 as well as IPv4. The port is then served by a single
+   *  dual-stack socket, which sees IPv4 peers as mapped IPv6 addresses.
+   */
+  bool dualStack = false;
+
+  /**
+   *  Also listen on a Unix domain socket at this path, which saves clients
+   *  on the same host the TCP stack. It serves exactly what the port does
+   *  and counts against the same AdmissionLimits. A socket file left at the
+   *  path by an earlier run is replaced, but one that a live server still
+   *  accepts on makes construction fail. The file is removed when the
+   *  Server is destroyed, unless something else has taken the path since.
+   *  Empty for none.
+   */
+  std::filesystem::path unixSocket;
+
+  /** Static files served alongside the httpMessage. */
+  StaticFileOptions staticFiles;
+
+  /** Encryption of every connection with TLS. */
+  TlsServerOptions tls;
 };
 
 
@@ -78,6 +469,10 @@ struct ServerImplDeleter {
  *  Text can be sent to the Server using Client::send() and received from the
  *  Server using Client::receive().
  *
+ *  When ServerOptions::ioThreads is nonzero, the socket I/O itself moves onto
+ *  background threads, but the API stays single threaded: every Server member
+ *  function must still be called from one thread, and callbacks run there.
+ *
  *  The Server is websocket based and supports sending a single file back in
  *  response to HTTP requests for `index.html`. This allows command line and
  *  web clients to interact.
@@ -99,17 +494,24 @@ public:
    *
    *  The httpMessage is a string containing HTML content that will be sent
    *  in response to standard HTTP requests for any path ending in `index.html`.
+   *  When ServerOptions::staticFiles names a directory, requests are served
+   *  from there instead, and the httpMessage only answers requests for `/`
+   *  or `index.html` that the directory has no file for.
    *
    *  Passing 0 as the port asks the operating system to choose any free port.
    *  Use getPort() afterwards to discover which one was actually bound.
+   *
+   *  The optional ServerOptions select non-default behavior such as running
+   *  I/O on background threads.
    */
   template <typename C, typename D>
   Server(unsigned short port,
          std::string httpMessage,
          C onConnect,
-         D onDisconnect)
+         D onDisconnect,
+         ServerOptions options = {})
     : connectionHandler{std::make_unique<ConnectionHandlerImpl<C,D>>(onConnect, onDisconnect)},
-      impl{buildImpl(*this, port, std::move(httpMessage))}
+      impl{buildImpl(*this, port, std::move(httpMessage), std::move(options))}
       { }
 
   /**
@@ -125,11 +527,57 @@ public:
    */
   void update();
 
+  /**
+   *  Like Server::update(), but if nothing is ready to be handled yet, first
+   *  block for up to `maxWait` until some network activity or timer
+   *  completes. Everything ready by then is handled before returning. This
+   *  lets a loop react to traffic immediately without spinning, e.g.
+   *  `while (running) { server.update(100ms); ... }`.
+   */
+  void update(std::chrono::nanoseconds maxWait);
+
   /**
    *  Send a list of messages to their respective Clients.
    */
   void send(const std::deque<Message>& messages);
 
+  /**
+   *  Send a single binary message to a Client. Binary messages skip the UTF-8
+   *  validation that text messages undergo.
+   */
+  void send(Connection connection, std::span<const std::byte> payload,
+            Priority priority = Priority::Normal);
+
+  /**
+   *  Send the same payload to every listed Client. The payload is stored once
+   *  and shared by all recipients instead of being copied per Connection, so
+   *  fanning out to many clients costs a constant number of allocations.
+   *  Connections that are no longer active are skipped.
+   */
+  void broadcast(std::string payload,
+                 std::span<const Connection> connections,
+                 MessageType type = MessageType::Text,
+                 Priority priority = Priority::Normal);
+
+  /**
+   *  Send the same payload to every currently connected Client.
+   */
+  void broadcast(std::string payload, MessageType type = MessageType::Text,
+                 Priority priority = Priority::Normal);
+
+  /**
+   *  Send a message that supersedes any earlier one with the same key, for
+   *  state where only the newest value matters. If a message with this key
+   *  is still queued for the Client, the payload takes its place in the
+   *  queue, keeping that message's position and priority. Otherwise it is
+   *  queued like any other. A Client that falls behind therefore never has
+   *  more than one message per key waiting for it. Keys are chosen by the
+   *  caller and are separate for every Connection.
+   */
+  void sendLatest(Connection connection, uint64_t key, std::string payload,
+                  MessageType type = MessageType::Text,
+                  Priority priority = Priority::Normal);
+
   /**
    *  Receive Message instances from Client instances. This returns all Message
    *  instances collected by previous calls to Server::update() and not yet
@@ -137,11 +585,67 @@ public:
    */
   [[nodiscard]] std::deque<Message> receive();
 
+  /**
+   *  Receive Message instances like Server::receive(), but into a vector the
+   *  caller keeps between calls. Any Messages still in `messages` from the
+   *  previous call are recycled first, as by Server::recycle(). The vector
+   *  is then swapped with the Server's internal queue, so the two trade
+   *  storage back and forth. Once both have grown to the peak number of
+   *  messages per update, receiving allocates nothing.
+   */
+  void receiveInto(std::vector<Message>& messages);
+
+  /**
+   *  Hand Messages obtained from Server::receive() back to the Server once
+   *  they are no longer needed. Their buffers are reused for later incoming
+   *  messages, so a steady stream of traffic no longer allocates per message.
+   *  Calling this is optional; Messages that are simply destroyed free their
+   *  storage as usual.
+   */
+  void recycle(std::deque<Message>&& messages);
+
   /**
    *  Disconnect the Client specified by the given Connection.
    */
   void disconnect(Connection connection);
 
+  /**
+   *  Returns a file descriptor that becomes readable when Server::update()
+   *  has work to do, for folding the Server into an external event loop such
+   *  as epoll. It stays readable until the next update(). This needs
+   *  ServerOptions::ioThreads to be nonzero, since an inline Server only
+   *  performs I/O inside update(); otherwise, and on Windows, it returns -1.
+   *  The descriptor is owned by the Server and must not be closed.
+   */
+  [[nodiscard]] int nativeHandle() const noexcept;
+
+  /**
+   *  Returns how many messages and bytes are waiting to be written to the
+   *  given Connection, or zeros if it is not connected. With I/O threads the
+   *  depth is maintained by the Connection's own thread, so it can briefly
+   *  trail the most recent sends.
+   */
+  [[nodiscard]] QueueDepth queueDepth(Connection connection) const;
+
+  /**
+   *  Returns a snapshot of the Server's traffic and scheduling counters. The
+   *  counters are always maintained; they cost a few relaxed stores per
+   *  message.
+   */
+  [[nodiscard]] ServerStats stats() const;
+
+  /**
+   *  Returns the traffic counters of the given Connection, or zeros if it is
+   *  not connected.
+   */
+  [[nodiscard]] ConnectionStats connectionStats(Connection connection) const;
+
+  /**
+   *  Returns how well outgoing messages compressed, summed over all
+   *  connections, and how much CPU time that took.
+   */
+  [[nodiscard]] CompressionStats compressionStats() const;
+
 private:
   friend class ServerImpl;
 
@@ -179,7 +683,10 @@ private:
   };
 
   static std::unique_ptr<ServerImpl,ServerImplDeleter>
-  buildImpl(Server& server, unsigned short port, std::string httpMessage);
+  buildImpl(Server& server,
+            unsigned short port,
+            std::string httpMessage,
+            ServerOptions options);
 
   std::unique_ptr<ConnectionHandler> connectionHandler;
   std::unique_ptr<ServerImpl,ServerImplDeleter> impl;
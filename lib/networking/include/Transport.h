@@ -0,0 +1,119 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NETWORKING_TRANSPORT_H
+#define NETWORKING_TRANSPORT_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace networking {
+
+
+/**
+ *  How a message's payload is framed. Text frames must hold valid UTF-8 and
+ *  are validated on arrival. Binary frames carry arbitrary bytes unchecked.
+ */
+enum class MessageType : uint8_t {
+  Text,
+  Binary
+};
+
+
+/**
+ *  Settings for the websocket permessage-deflate extension. Compression is
+ *  only used when both peers enable it; otherwise messages travel as is.
+ *  It trades CPU time for bandwidth, so it is disabled by default.
+ */
+struct CompressionOptions {
+  /** Offer or accept permessage-deflate during the handshake. */
+  bool enabled = false;
+
+  /** Largest LZ77 window (9 to 15 bits) the server may compress with. */
+  int serverMaxWindowBits = 15;
+
+  /** Largest LZ77 window (9 to 15 bits) the client may compress with. */
+  int clientMaxWindowBits = 15;
+
+  /**
+   *  Keep the compression dictionary between messages. This compresses
+   *  repetitive traffic much better, at the cost of keeping a deflate state
+   *  alive per connection. Disabling it resets the dictionary per message.
+   */
+  bool contextTakeover = true;
+
+  /** Messages smaller than this many bytes are sent uncompressed. */
+  size_t minMessageSize = 0;
+
+  /** The zlib compression level from 0 (none) to 9 (best). */
+  int level = 8;
+};
+
+
+/**
+ *  Deadlines that let either end reclaim a connection whose peer vanished
+ *  without closing it, as phones dropping off a network tend to do. A zero
+ *  duration disables the corresponding check.
+ */
+struct TimeoutOptions {
+  /** Time allowed to establish the websocket, handshake included. */
+  std::chrono::milliseconds handshake{30000};
+
+  /**
+   *  A connection on which nothing at all arrives for this long is closed
+   *  and reported as disconnected. The Server checks connections in coarse
+   *  steps, so closing may take up to a quarter longer. Disabled by default.
+   */
+  std::chrono::milliseconds idle{0};
+
+  /**
+   *  Once half of the idle timeout passes in silence, send a ping. A live
+   *  peer answers with a pong, which keeps a quiet connection open. Has no
+   *  effect without an idle timeout.
+   */
+  bool keepAlivePings = true;
+};
+
+
+/**
+ *  Counters describing the cost and benefit of compressing outgoing
+ *  messages. They are only collected while compression is enabled.
+ */
+struct CompressionStats {
+  /** Messages written while compression was enabled. */
+  uint64_t messages = 0;
+
+  /** Payload bytes of those messages before compression. */
+  uint64_t payloadBytes = 0;
+
+  /** Bytes actually written to the socket for them, framing included. */
+  uint64_t wireBytes = 0;
+
+  /**
+   *  Thread CPU time spent writing those messages, which is dominated by
+   *  deflate. Only the synchronous work of each write counts, framing
+   *  included; time spent waiting on the socket does not.
+   */
+  std::chrono::nanoseconds cpuTime{0};
+
+  /** Wire bytes per payload byte. Values below 1 mean bandwidth was saved. */
+  [[nodiscard]] double
+  ratio() const noexcept {
+    return payloadBytes == 0
+      ? 1.0
+      : static_cast<double>(wireBytes) / static_cast<double>(payloadBytes);
+  }
+};
+
+
+}
+
+
+#endif
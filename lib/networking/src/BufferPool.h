@@ -0,0 +1,83 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NETWORKING_BUFFER_POOL_H
+#define NETWORKING_BUFFER_POOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace networking {
+
+
+/**
+ *  A free list of strings that are kept for their capacity. Incoming frames
+ *  are read straight into a buffer from the pool and handed to the
+ *  application as is. Once the application returns the buffer, the next frame
+ *  reuses its storage, so a steady stream of messages causes no allocations.
+ *
+ *  Buffers are taken on the I/O threads and returned by the application, so
+ *  the list is guarded by a mutex. The lock is held only for a swap.
+ */
+class BufferPool {
+public:
+  /**
+   *  Keep at most `maxBuffers` buffers. Buffers that grew beyond
+   *  `maxCapacity` bytes are freed instead of pooled, so a single huge message
+   *  does not stay resident forever.
+   */
+  BufferPool(size_t maxBuffers, size_t maxCapacity)
+    : maxBuffers{maxBuffers},
+      maxCapacity{maxCapacity} {
+    free.reserve(maxBuffers);
+  }
+
+  /** Take an empty buffer, reusing pooled storage when there is some. */
+  [[nodiscard]] std::string
+  acquire() {
+    std::lock_guard lock{mutex};
+    if (free.empty()) {
+      return {};
+    }
+    std::string buffer = std::move(free.back());
+    free.pop_back();
+    return buffer;
+  }
+
+  /** Return a buffer for reuse. Its contents are discarded. */
+  void
+  release(std::string buffer) {
+    // Short strings live inline and have nothing worth keeping.
+    if (buffer.capacity() <= std::string{}.capacity()
+        || buffer.capacity() > maxCapacity) {
+      return;
+    }
+    buffer.clear();
+    std::lock_guard lock{mutex};
+    if (free.size() < maxBuffers) {
+      free.push_back(std::move(buffer));
+    }
+  }
+
+private:
+  const size_t maxBuffers;
+  const size_t maxCapacity;
+
+  std::mutex mutex;
+  std::vector<std::string> free;
+};
+
+
+}
+
+
+#endif
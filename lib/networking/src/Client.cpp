@@ -12,8 +12,23 @@
 #include <deque>
 #include <ranges>
 #include <utility>
+#include <vector>
 
 using networking::Client;
+using networking::ClientOptions;
+using networking::MessageType;
+
+
+namespace {
+
+// A message waiting to be sent. Binary payloads are carried in a string as
+// well, since both kinds are written from a contiguous buffer.
+struct Outbound {
+  std::string payload;
+  MessageType type = MessageType::Text;
+};
+
+}
 
 
 /////////////////////////////////////////////////////////////////////////////
@@ -26,22 +41,23 @@ using networking::Client;
 #include <emscripten/websocket.h>
 
 
+template <typename T>
 class SimpleChannel {
 public:
-  void send(std::string value) {
+  void send(T value) {
     queue.push_back(std::move(value));
   }
 
-  std::deque<std::string> drain() {
-    std::deque<std::string> result = std::move(queue);
-    queue = std::deque<std::string>{};
+  std::deque<T> drain() {
+    std::deque<T> result = std::move(queue);
+    queue = std::deque<T>{};
     return result;
   }
 
   bool empty() const { return queue.empty(); }
 
 private:
-  std::deque<std::string> queue;
+  std::deque<T> queue;
 };
 
 
@@ -62,7 +78,9 @@ namespace networking {
 
 class Client::ClientImpl {
 public:
-  ClientImpl(std::string_view address, std::string_view port)
+  ClientImpl(std::string_view address,
+             std::string_view port,
+             const ClientOptions& /*options*/)
     : hostAddress{makeHostAddress(address, port)},
       attrs{hostAddress.c_str(), nullptr, EM_TRUE},
       websocket{connect(attrs)}
@@ -78,14 +96,22 @@ public:
 
   void reportError(std::string_view message) const;
 
-  void update() {}
+  void update(std::chrono::nanoseconds /*maxWait*/) {}
 
-  void send(std::string message);
+  void send(Outbound message);
 
   std::deque<std::string> receive();
 
+  void recycle(std::deque<std::string>&& /*messages*/) { }
+
+  std::deque<std::vector<std::byte>> receiveBinary();
+
   bool isClosed() const { return closed; }
 
+  int nativeHandle() const { return -1; }
+
+  networking::CompressionStats compressionStats() const { return {}; }
+
 private:
 
   EMSCRIPTEN_WEBSOCKET_T connect(EmscriptenWebSocketCreateAttributes& attrs);
@@ -118,8 +144,11 @@ private:
   EmscriptenWebSocketCreateAttributes attrs;
   EMSCRIPTEN_WEBSOCKET_T websocket;
 
-  SimpleChannel incoming;
-  SimpleChannel outgoing;
+  bool transmit(const Outbound& message);
+
+  SimpleChannel<std::string> incoming;
+  SimpleChannel<std::vector<std::byte>> incomingBinary;
+  SimpleChannel<Outbound> outgoing;
 };
 
 
@@ -146,7 +175,7 @@ Client::ClientImpl::onOpenHelper(int eventType,
   auto* impl = static_cast<ClientImpl*>(implAsVoid);
 
   for (const auto& msg : impl->outgoing.drain()) {
-    emscripten_websocket_send_utf8_text(impl->websocket, msg.c_str());
+    impl->transmit(msg);
   }
 
   return EM_TRUE;
@@ -169,7 +198,10 @@ Client::ClientImpl::onMessageHelper(int eventType,
   auto* impl = static_cast<ClientImpl*>(implAsVoid);
 
   if (!websocketEvent->isText) {
-    impl->disconnect();
+    const auto* bytes = reinterpret_cast<const std::byte*>(websocketEvent->data);
+    impl->incomingBinary.send(
+      std::vector<std::byte>(bytes, bytes + websocketEvent->numBytes)
+    );
     return EM_TRUE;
   }
 
@@ -216,8 +248,21 @@ enum WSReadyStates : unsigned short {
 };
 
 
+bool
+Client::ClientImpl::transmit(const Outbound& message) {
+  if (message.type == MessageType::Binary) {
+    // The browser copies the bytes, so the const_cast is never written through.
+    return emscripten_websocket_send_binary(
+      websocket, const_cast<char*>(message.payload.data()),
+      message.payload.size()) == EMSCRIPTEN_RESULT_SUCCESS;
+  }
+  return emscripten_websocket_send_utf8_text(
+    websocket, message.payload.c_str()) == EMSCRIPTEN_RESULT_SUCCESS;
+}
+
+
 void
-Client::ClientImpl::send(std::string message) {
+Client::ClientImpl::send(Outbound message) {
   if (closed) {
     return;
   }
@@ -229,7 +274,7 @@ Client::ClientImpl::send(std::string message) {
   }
 
   if (readyState == OPEN) {
-    if (auto result = emscripten_websocket_send_utf8_text(websocket, message.c_str())) {
+    if (!transmit(message)) {
       disconnect();
     }
   } else {
@@ -244,15 +289,35 @@ Client::ClientImpl::receive() {
 }
 
 
+std::deque<std::vector<std::byte>>
+Client::ClientImpl::receiveBinary() {
+  return incomingBinary.drain();
+}
+
+
 #else
 
+#include "BufferPool.h"
+#include "CoalescingStream.h"
+#include "Compression.h"
+#include "MaybeTlsStream.h"
+#include "Wakeup.h"
+
 #include <boost/asio.hpp>
 #include <boost/asio/cancel_after.hpp>
 #include <boost/asio/experimental/awaitable_operators.hpp>
 #include <boost/beast.hpp>
 
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
 
 namespace asio = boost::asio;
 namespace beast = boost::beast;
@@ -264,16 +329,152 @@ using namespace asio::experimental::awaitable_operators;
 using namespace std::chrono_literals;
 
 
+// Bounds on the buffers a client keeps around for incoming messages.
+static constexpr size_t RECEIVE_POOL_BUFFERS = 64;
+static constexpr size_t RECEIVE_POOL_BUFFER_BYTES = 1024 * 1024;
+
+
 namespace networking {
 
 
+// A Client has a single connection, so beast's own per-stream timer is cheap
+// enough here. It pings after half of the idle timeout, as the Server does.
+static beast::websocket::stream_base::timeout
+toTimeoutOption(const TimeoutOptions& timeouts) {
+  using beast::websocket::stream_base;
+  stream_base::timeout timeout{stream_base::none(), stream_base::none(), false};
+  if (timeouts.handshake > 0ms) {
+    timeout.handshake_timeout = timeouts.handshake;
+  }
+  if (timeouts.idle > 0ms) {
+    timeout.idle_timeout = timeouts.idle;
+    timeout.keep_alive_pings = timeouts.keepAlivePings;
+  }
+  return timeout;
+}
+
+
+// TCP and Unix domain sockets look the same once connected, and so do plain
+// and TLS connections.
+using StreamSocket = asio::generic::stream_protocol::socket;
+using TransportStream = MaybeTlsStream<StreamSocket>;
+
+
+#ifdef NETWORKING_ENABLE_TLS
+
+// The latest session each Server handed out, by address and the way the
+// Client checked its certificate, so that the next Client to connect there
+// and trust it the same way can resume it. Resuming skips the certificate
+// check, so only sessions from verified handshakes are kept. Clients on I/O
+// threads store and look up sessions concurrently, so the map is guarded by
+// a mutex.
+class TlsSessionCache {
+public:
+  static TlsSessionCache&
+  instance() {
+    static TlsSessionCache cache;
+    return cache;
+  }
+
+  // Takes over the caller's reference to the session.
+  void
+  store(const std::string& key, SSL_SESSION* session) {
+    std::lock_guard lock{mutex};
+    auto found = sessions.find(key);
+    if (found == sessions.end()) {
+      // Any entry will do to make room; this only bounds the memory held.
+      if (sessions.size() >= MAX_SESSIONS) {
+        sessions.erase(sessions.begin());
+      }
+      found = sessions.emplace(key, nullptr).first;
+    }
+    found->second.reset(session);
+  }
+
+  // Offers the cached session for `key`, if any, to a connection about to
+  // handshake.
+  void
+  offer(const std::string& key, SSL* ssl) {
+    std::lock_guard lock{mutex};
+    if (auto found = sessions.find(key); found != sessions.end()) {
+      SSL_set_session(ssl, found->second.get());
+    }
+  }
+
+private:
+  static constexpr size_t MAX_SESSIONS = 256;
+
+  struct SessionFree {
+    void operator()(SSL_SESSION* session) const { SSL_SESSION_free(session); }
+  };
+
+  std::mutex mutex;
+  std::unordered_map<std::string, std::unique_ptr<SSL_SESSION, SessionFree>>
+    sessions;
+};
+
+
+// With TLS 1.3 the session tickets only arrive after the handshake, so they
+// are collected as OpenSSL announces them rather than when connecting.
+static int
+onNewTlsSession(SSL* ssl, SSL_SESSION* session) {
+  const auto* key = static_cast<const std::string*>(SSL_get_app_data(ssl));
+  const bool verified = (SSL_get_verify_mode(ssl) & SSL_VERIFY_PEER) != 0
+                     && SSL_get_verify_result(ssl) == X509_V_OK;
+  if (key == nullptr || !verified) {
+    return 0;
+  }
+  TlsSessionCache::instance().store(*key, session);
+  return 1;
+}
+
+
+static asio::ssl::context
+makeTlsContext(const TlsClientOptions& tls) {
+  asio::ssl::context context{asio::ssl::context::tls_client};
+  context.set_options(asio::ssl::context::default_workarounds
+                      | asio::ssl::context::no_sslv2
+                      | asio::ssl::context::no_sslv3
+                      | asio::ssl::context::no_tlsv1
+                      | asio::ssl::context::no_tlsv1_1);
+  if (tls.caFile.empty()) {
+    context.set_default_verify_paths();
+  } else {
+    context.load_verify_file(tls.caFile.string());
+  }
+  context.set_verify_mode(tls.verifyPeer ? asio::ssl::verify_peer
+                                         : asio::ssl::verify_none);
+  if (tls.sessionResumption) {
+    SSL_CTX* native = context.native_handle();
+    SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_CLIENT
+                                           | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(native, onNewTlsSession);
+  }
+  return context;
+}
+
+#endif
+
+
 class Client::ClientImpl {
 public:
-  ClientImpl(std::string_view address, std::string_view port)
-    : websocket{ioContext},
+  ClientImpl(std::string_view address,
+             std::string_view port,
+             const ClientOptions& options)
+    : writeBatchBytes{options.writeBatchBytes},
+      metered{options.compression.enabled},
+      threaded{options.ioThread},
+      connectTimeout{options.timeouts.handshake},
+      unixSocket{options.unixSocket},
+      tls{options.tls},
+      websocket{ioContext},
       wakeTimer{ioContext, std::chrono::steady_clock::time_point::max()},
       hostAddress{address},
       hostPort{port} {
+    checkCompressionOptions(options.compression);
+    websocket.set_option(toDeflateOption(options.compression));
+    websocket.read_message_max(options.maxMessageBytes);
+    websocket.set_option(toTimeoutOption(options.timeouts));
     asio::co_spawn(ioContext, session(),
       asio::bind_cancellation_slot(stopSignal.slot(),
         [this](std::exception_ptr error) {
@@ -282,16 +483,47 @@ public:
           }
           closed = true;
           sessionDone = true;
+          notifyIncoming();
         }));
+    if (threaded) {
+      wakeup.emplace();
+      thread = std::thread{[this] {
+        // An exception escaping a handler would otherwise terminate the
+        // process. The connection cannot be trusted afterwards, so it is
+        // reported as closed; the destructor still winds the session down.
+        try {
+          ioContext.run();
+        } catch (...) {
+          reportError("I/O thread ended with an exception");
+          closed = true;
+          notifyIncoming();
+        }
+      }};
+    }
   }
 
   ~ClientImpl() {
-    stopSignal.emit(asio::cancellation_type::terminal);
+    if (threaded) {
+      // The I/O thread returns from run() once the session has completed.
+      asio::post(ioContext, [this] {
+        stopSignal.emit(asio::cancellation_type::terminal);
+      });
+      thread.join();
+    } else {
+      stopSignal.emit(asio::cancellation_type::terminal);
+    }
     // Drive the context until the session coroutine has completed, so its
     // frame and every queued message are destroyed deterministically.
     while (!sessionDone) {
       ioContext.restart();
-      if (ioContext.run() == 0 && !sessionDone) {
+      size_t handled = 0;
+      try {
+        handled = ioContext.run();
+      } catch (...) {
+        // The handler that threw has been consumed; keep winding down.
+        continue;
+      }
+      if (handled == 0 && !sessionDone) {
         // No further progress is possible. This indicates the session is
         // suspended on something cancellation cannot reach — a bug.
         assert(false && "session coroutine failed to complete during shutdown");
@@ -302,42 +534,109 @@ public:
 
   void reportError(std::string_view message) const;
 
-  void update() { ioContext.poll(); }
+  void
+  update(std::chrono::nanoseconds maxWait) {
+    if (threaded) {
+      // The I/O thread does the work, so there is only something to wait for.
+      std::unique_lock lock{incomingMutex};
+      incomingReady.wait_for(lock, maxWait, [this] {
+        return !incoming.empty() || !incomingBinary.empty() || closed;
+      });
+      wakeup->clear();
+      return;
+    }
+    if (maxWait > 0ns && incoming.empty() && incomingBinary.empty()) {
+      ioContext.run_one_for(maxWait);
+    }
+    ioContext.poll();
+  }
 
-  void send(std::string message);
+  void send(Outbound message);
 
   std::deque<std::string> receive() {
+    std::lock_guard lock{incomingMutex};
     return std::exchange(incoming, std::deque<std::string>{});
   }
 
+  void
+  recycle(std::deque<std::string>&& messages) {
+    for (auto& message : messages) {
+      receiveBuffers.release(std::move(message));
+    }
+  }
+
+  std::deque<std::vector<std::byte>> receiveBinary() {
+    std::lock_guard lock{incomingMutex};
+    return std::exchange(incomingBinary, std::deque<std::vector<std::byte>>{});
+  }
+
   bool isClosed() const { return closed; }
 
+  int nativeHandle() const { return wakeup ? wakeup->handle() : -1; }
+
+  CompressionStats
+  compressionStats() const {
+    CompressionStats stats;
+    compression.addTo(stats);
+    return stats;
+  }
+
 private:
   awaitable<void> session();
+  awaitable<boost::system::error_code> connectTcp();
+  awaitable<boost::system::error_code> connectUnix();
+  awaitable<boost::system::error_code> handshakeTls();
   awaitable<void> reader();
   awaitable<void> writer();
 
+  void enqueue(Outbound message);
+  void notifyIncoming();
+
+  const size_t writeBatchBytes;
+  const bool metered;
+  const bool threaded;
+  const std::chrono::milliseconds connectTimeout;
+  const std::filesystem::path unixSocket;
+  const TlsClientOptions tls;
+  CompressionMeter compression;
   asio::io_context ioContext;
-  beast::websocket::stream<asio::ip::tcp::socket> websocket;
+#ifdef NETWORKING_ENABLE_TLS
+  // Declared before the websocket, whose TLS stream refers to it.
+  std::optional<asio::ssl::context> tlsContext;
+  // Names the Server in the session cache. Handed to OpenSSL as app data.
+  std::string tlsSessionKey;
+#endif
+  beast::websocket::stream<CoalescingStream<TransportStream>> websocket;
 
   // The timer is parked forever and cancelled to signal "queue is not empty".
   asio::steady_timer wakeTimer;
-  std::deque<std::string> outbound;
+  std::deque<Outbound> outbound;
+
+  // Filled by the reader and emptied by receive(). With an I/O thread these
+  // are the only state the two threads share, hence the mutex.
+  std::mutex incomingMutex;
+  std::condition_variable incomingReady;
   std::deque<std::string> incoming;
+  std::deque<std::vector<std::byte>> incomingBinary;
+  BufferPool receiveBuffers{RECEIVE_POOL_BUFFERS, RECEIVE_POOL_BUFFER_BYTES};
 
   asio::cancellation_signal stopSignal;
-  bool closed = false;
+  std::atomic<bool> closed = false;
   bool sessionDone = false;
   std::string hostAddress;
   std::string hostPort;
+
+  // Only used with ClientOptions::ioThread.
+  std::optional<Wakeup> wakeup;
+  std::thread thread;
 };
 
 
 }
 
 
-boost::asio::awaitable<void>
-Client::ClientImpl::session() {
+boost::asio::awaitable<boost::system::error_code>
+Client::ClientImpl::connectTcp() {
   asio::ip::tcp::resolver resolver{ioContext};
   // Note: unlike the async form, this call is not cancellable, so a slow or
   // unreachable DNS server stalls the first update() (or the destructor drain,
@@ -346,18 +645,104 @@ Client::ClientImpl::session() {
   auto endpoints = resolver.resolve(hostAddress, hostPort, resolveError);
   if (resolveError) {
     reportError("Resolve failed");
-    co_return;
+    co_return resolveError;
   }
 
-  auto [connectError, endpoint] =
-    co_await asio::async_connect(websocket.next_layer(), endpoints,
-                                 as_tuple(use_awaitable));
+  asio::ip::tcp::socket socket{ioContext};
+  auto [connectError, endpoint] = connectTimeout > 0ms
+    ? co_await asio::async_connect(socket, endpoints,
+        asio::cancel_after(connectTimeout, as_tuple(use_awaitable)))
+    : co_await asio::async_connect(socket, endpoints, as_tuple(use_awaitable));
   (void)endpoint;
+  if (!connectError) {
+    beast::get_lowest_layer(websocket) = std::move(socket);
+  }
+  co_return connectError;
+}
+
+
+boost::asio::awaitable<boost::system::error_code>
+Client::ClientImpl::connectUnix() {
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+  asio::local::stream_protocol::socket socket{ioContext};
+  const asio::local::stream_protocol::endpoint endpoint{unixSocket.string()};
+  auto [connectError] = connectTimeout > 0ms
+    ? co_await socket.async_connect(endpoint,
+        asio::cancel_after(connectTimeout, as_tuple(use_awaitable)))
+    : co_await socket.async_connect(endpoint, as_tuple(use_awaitable));
+  if (!connectError) {
+    beast::get_lowest_layer(websocket) = std::move(socket);
+  }
+  co_return connectError;
+#else
+  co_return asio::error::operation_not_supported;
+#endif
+}
+
+
+boost::asio::awaitable<boost::system::error_code>
+Client::ClientImpl::handshakeTls() {
+#ifdef NETWORKING_ENABLE_TLS
+  tlsContext.emplace(makeTlsContext(tls));
+  auto& stream = websocket.next_layer().next_layer();
+  stream.startTls(*tlsContext);
+  auto& tlsStream = stream.tlsStream();
+  SSL* ssl = tlsStream.native_handle();
+
+  // Name the host for virtual hosting and for checking the certificate.
+  // Addresses are not valid server names, so those are only checked.
+  boost::system::error_code addressError;
+  asio::ip::make_address(hostAddress, addressError);
+  if (addressError) {
+    SSL_set_tlsext_host_name(ssl, hostAddress.c_str());
+  }
+  if (tls.verifyPeer) {
+    tlsStream.set_verify_callback(
+      asio::ssl::host_name_verification{hostAddress});
+  }
+  if (tls.sessionResumption) {
+    std::error_code ignored;
+    const auto caFile = tls.caFile.empty()
+      ? tls.caFile
+      : std::filesystem::absolute(tls.caFile, ignored);
+    tlsSessionKey = (unixSocket.empty()
+                       ? hostAddress + ":" + hostPort
+                       : unixSocket.string())
+      + (tls.verifyPeer ? "\nverify\n" : "\nno-verify\n")
+      + caFile.string();
+    SSL_set_app_data(ssl, &tlsSessionKey);
+    TlsSessionCache::instance().offer(tlsSessionKey, ssl);
+  }
+
+  auto [error] = connectTimeout > 0ms
+    ? co_await tlsStream.async_handshake(asio::ssl::stream_base::client,
+        asio::cancel_after(connectTimeout, as_tuple(use_awaitable)))
+    : co_await tlsStream.async_handshake(asio::ssl::stream_base::client,
+                                         as_tuple(use_awaitable));
+  co_return error;
+#else
+  co_return asio::error::operation_not_supported;
+#endif
+}
+
+
+boost::asio::awaitable<void>
+Client::ClientImpl::session() {
+  const auto connectError = unixSocket.empty()
+    ? co_await connectTcp()
+    : co_await connectUnix();
   if (connectError) {
     reportError("Connect failed");
     co_return;
   }
 
+  if (tls.enabled) {
+    if (co_await handshakeTls()) {
+      reportError("TLS handshake failed");
+      co_return;
+    }
+  }
+
   auto [handshakeError] =
     co_await websocket.async_handshake(hostAddress, "/",
                                        as_tuple(use_awaitable));
@@ -382,22 +767,35 @@ Client::ClientImpl::session() {
 
 boost::asio::awaitable<void>
 Client::ClientImpl::reader() {
-  beast::flat_buffer buffer;
   while (true) {
+    // Frames are read into pooled buffers that receive() hands back once
+    // their text has been copied out.
+    std::string text = receiveBuffers.acquire();
+    auto buffer = asio::dynamic_buffer(text);
     auto [error, bytes] =
       co_await websocket.async_read(buffer, as_tuple(use_awaitable));
     (void)bytes;
     if (error) {
       co_return;
     }
-    incoming.push_back(beast::buffers_to_string(buffer.data()));
-    buffer.consume(buffer.size());
+    {
+      std::lock_guard lock{incomingMutex};
+      if (websocket.got_binary()) {
+        const auto* data = reinterpret_cast<const std::byte*>(text.data());
+        incomingBinary.emplace_back(data, data + text.size());
+        receiveBuffers.release(std::move(text));
+      } else {
+        incoming.push_back(std::move(text));
+      }
+    }
+    notifyIncoming();
   }
 }
 
 
 boost::asio::awaitable<void>
 Client::ClientImpl::writer() {
+  auto& transport = websocket.next_layer();
   auto cancelState = co_await asio::this_coro::cancellation_state;
   while (cancelState.cancelled() == asio::cancellation_type::none) {
     if (outbound.empty()) {
@@ -406,29 +804,81 @@ Client::ClientImpl::writer() {
       co_await wakeTimer.async_wait(as_tuple(use_awaitable));
       continue;
     }
-    std::string message = std::move(outbound.front());
-    outbound.pop_front();
-    auto [error, bytes] =
-      co_await websocket.async_write(asio::buffer(message),
-                                     as_tuple(use_awaitable));
-    (void)bytes;
-    if (error) {
-      co_return;
+
+    // Batch queued messages into one socket write, as the server does.
+    const bool batched = outbound.front().payload.size() < writeBatchBytes;
+    if (batched) {
+      transport.cork();
+    }
+    size_t batchBytes = 0;
+    do {
+      Outbound message = std::move(outbound.front());
+      outbound.pop_front();
+      batchBytes += message.payload.size();
+      const auto wireBefore = transport.bytesWritten();
+      websocket.binary(message.type == MessageType::Binary);
+      // Meter only the synchronous parts of the write, where deflate runs.
+      if (metered) {
+        transport.meterCpu();
+      }
+      auto [error, bytes] =
+        co_await websocket.async_write(asio::buffer(message.payload),
+                                       as_tuple(use_awaitable));
+      transport.pauseCpuMeter();
+      if (error) {
+        transport.abandon();
+        co_return;
+      }
+      if (metered) {
+        compression.record(bytes, transport.bytesWritten() - wireBefore,
+                           transport.takeCpuTime());
+      }
+    } while (batched && !outbound.empty()
+             && batchBytes + outbound.front().payload.size() <= writeBatchBytes);
+
+    if (transport.isCorked()) {
+      auto [error] = co_await transport.async_flush(as_tuple(use_awaitable));
+      if (error) {
+        co_return;
+      }
     }
   }
 }
 
 
 void
-Client::ClientImpl::send(std::string message) {
-  if (closed || message.empty()) {
+Client::ClientImpl::send(Outbound message) {
+  if (closed || message.payload.empty()) {
     return;
   }
+  if (threaded) {
+    asio::post(ioContext, [this, message = std::move(message)]() mutable {
+      enqueue(std::move(message));
+    });
+  } else {
+    enqueue(std::move(message));
+  }
+}
+
+
+void
+Client::ClientImpl::enqueue(Outbound message) {
   outbound.push_back(std::move(message));
   wakeTimer.cancel_one();
 }
 
 
+void
+Client::ClientImpl::notifyIncoming() {
+  if (threaded) {
+    // Taking the lock orders this with a waiter checking its predicate.
+    { std::lock_guard lock{incomingMutex}; }
+    incomingReady.notify_one();
+    wakeup->notify();
+  }
+}
+
+
 #endif
 
 
@@ -437,8 +887,10 @@ Client::ClientImpl::send(std::string message) {
 /////////////////////////////////////////////////////////////////////////////
 
 
-Client::Client(std::string_view address, std::string_view port)
-  : impl{std::make_unique<ClientImpl>(address, port)}
+Client::Client(std::string_view address,
+               std::string_view port,
+               ClientOptions options)
+  : impl{std::make_unique<ClientImpl>(address, port, options)}
     { }
 
 
@@ -454,15 +906,24 @@ Client::ClientImpl::reportError(std::string_view /*message*/) const {
 
 void
 Client::update() {
-  impl->update();
+  impl->update(std::chrono::nanoseconds::zero());
+}
+
+
+void
+Client::update(std::chrono::nanoseconds maxWait) {
+  impl->update(maxWait);
 }
 
 
 std::string
 Client::receive() {
-  return impl->receive()
+  auto messages = impl->receive();
+  auto text = messages
       | std::views::join
       | std::ranges::to<std::string>();
+  impl->recycle(std::move(messages));
+  return text;
 }
 
 
@@ -471,7 +932,24 @@ Client::send(std::string message) {
   if (message.empty()) {
     return;
   }
-  impl->send(std::move(message));
+  impl->send({std::move(message), MessageType::Text});
+}
+
+
+void
+Client::send(std::span<const std::byte> payload) {
+  if (payload.empty()) {
+    return;
+  }
+  impl->send({std::string{reinterpret_cast<const char*>(payload.data()),
+                          payload.size()},
+              MessageType::Binary});
+}
+
+
+std::deque<std::vector<std::byte>>
+Client::receiveBinary() {
+  return impl->receiveBinary();
 }
 
 
@@ -479,3 +957,15 @@ bool
 Client::isDisconnected() const noexcept {
   return impl->isClosed();
 }
+
+
+int
+Client::nativeHandle() const noexcept {
+  return impl->nativeHandle();
+}
+
+
+networking::CompressionStats
+Client::compressionStats() const {
+  return impl->compressionStats();
+}
@@ -0,0 +1,264 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NETWORKING_COALESCING_STREAM_H
+#define NETWORKING_COALESCING_STREAM_H
+
+#include "Compression.h"
+
+#include <boost/asio.hpp>
+#include <boost/beast/core/stream_traits.hpp>
+#include <boost/beast/websocket/teardown.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+
+
+namespace networking {
+
+
+/**
+ *  @class CoalescingStream
+ *
+ *  @brief A pass-through stream layer that can hold writes back and send
+ *  them in one batch.
+ *
+ *  A websocket stream frames exactly one message per write, so a queue of
+ *  small messages costs one syscall each. Placed beneath the websocket, this
+ *  layer lets a writer cork() the stream, issue several message writes that
+ *  complete at once into a staging buffer, and then flush() all the framed
+ *  bytes with a single socket write.
+ *
+ *  Every byte the websocket emits passes through here, including the control
+ *  frames it sends on its own. Those are staged too while corked (and while a
+ *  flush is in flight), so nothing can ever interleave with a batch on the
+ *  wire. When not corked, writes go straight to the next layer.
+ *
+ *  It can also meter the CPU time of the writes above it; see meterCpu().
+ */
+template <typename NextLayer>
+class CoalescingStream {
+public:
+  using next_layer_type = NextLayer;
+  using executor_type = typename NextLayer::executor_type;
+
+  template <typename... Args>
+  explicit CoalescingStream(Args&&... args)
+    : next{std::forward<Args>(args)...}
+      { }
+
+  [[nodiscard]] executor_type get_executor() noexcept { return next.get_executor(); }
+
+  [[nodiscard]] NextLayer& next_layer() noexcept { return next; }
+  [[nodiscard]] const NextLayer& next_layer() const noexcept { return next; }
+
+  template <typename MutableBuffers, typename Token>
+  auto
+  async_read_some(const MutableBuffers& buffers, Token&& token) {
+    return boost::asio::async_initiate<Token,
+                                       void(boost::system::error_code, size_t)>(
+      [this](auto handler, const MutableBuffers& buffers) {
+        auto executor =
+          boost::asio::get_associated_executor(handler, get_executor());
+        auto slot = boost::asio::get_associated_cancellation_slot(handler);
+        next.async_read_some(buffers,
+          boost::asio::bind_executor(executor,
+            boost::asio::bind_cancellation_slot(slot,
+              [this, handler = std::move(handler)]
+              (boost::system::error_code error, size_t bytes) mutable {
+                read += bytes;
+                std::move(handler)(error, bytes);
+              })));
+      },
+      token, buffers);
+  }
+
+  template <typename ConstBuffers, typename Token>
+  auto
+  async_write_some(const ConstBuffers& buffers, Token&& token) {
+    return boost::asio::async_initiate<Token,
+                                       void(boost::system::error_code, size_t)>(
+      [this](auto handler, const ConstBuffers& buffers) {
+        closeCpuInterval();
+        if (!corked) {
+          // Count the bytes on completion, keeping the handler's executor
+          // and cancellation slot so the socket write stays cancellable.
+          auto executor =
+            boost::asio::get_associated_executor(handler, get_executor());
+          auto slot = boost::asio::get_associated_cancellation_slot(handler);
+          next.async_write_some(buffers,
+            boost::asio::bind_executor(executor,
+              boost::asio::bind_cancellation_slot(slot,
+                [this, handler = std::move(handler)]
+                (boost::system::error_code error, size_t bytes) mutable {
+                  written += bytes;
+                  openCpuInterval();
+                  std::move(handler)(error, bytes);
+                })));
+          return;
+        }
+        const size_t size = boost::asio::buffer_size(buffers);
+        written += size;
+        const size_t offset = staged.size();
+        staged.resize(offset + size);
+        boost::asio::buffer_copy(boost::asio::buffer(staged.data() + offset, size),
+                                 buffers);
+        auto executor =
+          boost::asio::get_associated_executor(handler, get_executor());
+        boost::asio::post(get_executor(),
+          boost::asio::bind_executor(executor,
+            [this, handler = std::move(handler), size]() mutable {
+              openCpuInterval();
+              std::move(handler)(boost::system::error_code{}, size);
+            }));
+      },
+      token, buffers);
+  }
+
+  /**
+   *  Start metering CPU time for a write that is about to begin, until
+   *  pauseCpuMeter(). What counts is the synchronous work from here, and
+   *  from every completion of a write on this layer, up to the next write
+   *  that reaches it. For a websocket write that is where the message is
+   *  framed and deflated. Time the write spends waiting, while the thread
+   *  runs other handlers, is left out.
+   */
+  void
+  meterCpu() noexcept {
+    metering = true;
+    cpuMark = threadCpuTime();
+  }
+
+  void
+  pauseCpuMeter() noexcept {
+    metering = false;
+    cpuMark.reset();
+  }
+
+  /** The CPU time metered since the previous call. */
+  [[nodiscard]] std::chrono::nanoseconds
+  takeCpuTime() noexcept {
+    return std::exchange(cpuTime, std::chrono::nanoseconds{0});
+  }
+
+  /** Start staging writes instead of sending them. */
+  void cork() noexcept { corked = true; }
+
+  [[nodiscard]] bool isCorked() const noexcept { return corked; }
+
+  /**
+   *  Total bytes written through this layer. Staged bytes count as soon as
+   *  they are staged.
+   */
+  [[nodiscard]] uint64_t bytesWritten() const noexcept { return written; }
+
+  /**
+   *  Total bytes read through this layer, control frames included. A change
+   *  shows that the peer is alive even while a long message is still
+   *  arriving.
+   */
+  [[nodiscard]] uint64_t bytesRead() const noexcept { return read; }
+
+  /**
+   *  Send everything staged since cork() with one write per round, then
+   *  return to pass-through mode. Bytes staged while a round is in flight are
+   *  sent by a further round.
+   */
+  template <typename Token>
+  auto
+  async_flush(Token&& token) {
+    return boost::asio::async_compose<Token, void(boost::system::error_code)>(
+      [this, sending = false](auto& self,
+                              boost::system::error_code error = {},
+                              size_t /*bytes*/ = 0) mutable {
+        if (sending) {
+          inFlight.clear();
+        }
+        if (error || staged.empty()) {
+          abandon();
+          self.complete(error);
+          return;
+        }
+        sending = true;
+        std::swap(staged, inFlight);
+        boost::asio::async_write(next, boost::asio::buffer(inFlight),
+                                 std::move(self));
+      },
+      token, next);
+  }
+
+  /**
+   *  Return to pass-through mode, discarding anything still staged. Used when
+   *  a writer stops in the middle of a batch, after which the connection is
+   *  being torn down anyway.
+   */
+  void
+  abandon() noexcept {
+    corked = false;
+    staged.clear();
+  }
+
+private:
+  void
+  openCpuInterval() noexcept {
+    if (metering) {
+      cpuMark = threadCpuTime();
+    }
+  }
+
+  void
+  closeCpuInterval() noexcept {
+    if (cpuMark) {
+      cpuTime += threadCpuTime() - *cpuMark;
+      cpuMark.reset();
+    }
+  }
+
+  NextLayer next;
+  bool corked = false;
+  bool metering = false;
+  std::optional<std::chrono::nanoseconds> cpuMark;
+  std::chrono::nanoseconds cpuTime{0};
+  uint64_t written = 0;
+  uint64_t read = 0;
+  std::string staged;
+  std::string inFlight;
+};
+
+
+// Websocket streams tear down their next layer when closing. These overloads
+// are found by argument dependent lookup and forward to the wrapped layer.
+
+template <typename NextLayer>
+void
+teardown(boost::beast::role_type role,
+         CoalescingStream<NextLayer>& stream,
+         boost::system::error_code& error) {
+  using boost::beast::websocket::teardown;
+  teardown(role, stream.next_layer(), error);
+}
+
+
+template <typename NextLayer, typename TeardownHandler>
+void
+async_teardown(boost::beast::role_type role,
+               CoalescingStream<NextLayer>& stream,
+               TeardownHandler&& handler) {
+  using boost::beast::websocket::async_teardown;
+  async_teardown(role, stream.next_layer(),
+                 std::forward<TeardownHandler>(handler));
+}
+
+
+}
+
+
+#endif
@@ -0,0 +1,152 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NETWORKING_COMPRESSION_H
+#define NETWORKING_COMPRESSION_H
+
+#include "Counter.h"
+#include "Transport.h"
+
+#include <boost/beast/websocket/option.hpp>
+#include <boost/beast/zlib/deflate_stream.hpp>
+#include <boost/crc.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <optional>
+#include <string>
+#include <string_view>
+
+
+namespace networking {
+
+
+/**
+ *  Throw if the settings are out of the range permessage-deflate allows.
+ *  Beast would otherwise throw when the option is applied to each new
+ *  stream, long after the Server or Client was set up.
+ */
+inline void
+checkCompressionOptions(const CompressionOptions& options) {
+  const auto check = [](int value, int min, int max, const char* name) {
+    if (value < min || value > max) {
+      throw boost::system::system_error{
+        make_error_code(boost::system::errc::invalid_argument), name};
+    }
+  };
+  check(options.serverMaxWindowBits, 9, 15, "serverMaxWindowBits");
+  check(options.clientMaxWindowBits, 9, 15, "clientMaxWindowBits");
+  check(options.level, 0, 9, "compression level");
+}
+
+
+/** Translate the public compression settings into the beast stream option. */
+inline boost::beast::websocket::permessage_deflate
+toDeflateOption(const CompressionOptions& options) {
+  boost::beast::websocket::permessage_deflate deflate;
+  // Beast consults the flag matching the role the stream plays.
+  deflate.server_enable = options.enabled;
+  deflate.client_enable = options.enabled;
+  deflate.server_max_window_bits = options.serverMaxWindowBits;
+  deflate.client_max_window_bits = options.clientMaxWindowBits;
+  deflate.server_no_context_takeover = !options.contextTakeover;
+  deflate.client_no_context_takeover = !options.contextTakeover;
+  deflate.msg_size_threshold = options.minMessageSize;
+  deflate.compLevel = options.level;
+  return deflate;
+}
+
+
+/** Accumulates CompressionStats from the thread that writes messages. */
+struct CompressionMeter {
+  void
+  record(uint64_t payload, uint64_t wire, std::chrono::nanoseconds cpu) noexcept {
+    messages.add(1);
+    payloadBytes.add(payload);
+    wireBytes.add(wire);
+    cpuNanos.add(static_cast<uint64_t>(cpu.count()));
+  }
+
+  void
+  addTo(CompressionStats& stats) const noexcept {
+    stats.messages += messages.get();
+    stats.payloadBytes += payloadBytes.get();
+    stats.wireBytes += wireBytes.get();
+    stats.cpuTime += std::chrono::nanoseconds{cpuNanos.get()};
+  }
+
+  Counter messages;
+  Counter payloadBytes;
+  Counter wireBytes;
+  Counter cpuNanos;
+};
+
+
+/** CPU time consumed so far by the calling thread, where supported. */
+inline std::chrono::nanoseconds
+threadCpuTime() noexcept {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+  timespec now{};
+  ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return std::chrono::seconds{now.tv_sec} + std::chrono::nanoseconds{now.tv_nsec};
+#else
+  return std::chrono::nanoseconds{0};
+#endif
+}
+
+
+
+/**
+ *  Compress `data` into a complete gzip member (RFC 1952) at the best
+ *  compression level. Meant for content that is compressed once and served
+ *  many times, so speed is not a concern. Returns nothing if deflate fails
+ *  or does not consume all of the input.
+ */
+inline std::optional<std::string>
+gzip(std::string_view data) {
+  namespace zlib = boost::beast::zlib;
+
+  // Magic, deflate, no flags, no mtime, maximum compression, unknown OS.
+  std::string out{"\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\xff", 10};
+  const size_t headerSize = out.size();
+  out.resize(headerSize + zlib::deflate_upper_bound(data.size()));
+
+  zlib::deflate_stream deflater;
+  deflater.reset(9, 15, 8, zlib::Strategy::normal);
+  zlib::z_params params;
+  params.next_in = data.data();
+  params.avail_in = data.size();
+  params.next_out = out.data() + headerSize;
+  params.avail_out = out.size() - headerSize;
+  boost::beast::error_code error;
+  deflater.write(params, zlib::Flush::finish, error);
+  // A finished stream is reported as end_of_stream.
+  if (error != zlib::error::end_of_stream || params.avail_in != 0) {
+    return std::nullopt;
+  }
+  out.resize(headerSize + params.total_out);
+
+  boost::crc_32_type crc;
+  crc.process_bytes(data.data(), data.size());
+  const auto appendLittleEndian = [&out](uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+  };
+  appendLittleEndian(crc.checksum());
+  appendLittleEndian(static_cast<uint32_t>(data.size()));
+  return out;
+}
+
+
+}
+
+
+#endif
@@ -0,0 +1,46 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NETWORKING_COUNTER_H
+#define NETWORKING_COUNTER_H
+
+#include <atomic>
+#include <cstdint>
+
+
+namespace networking {
+
+
+/**
+ *  A statistic updated by a single thread and readable from any thread.
+ *  Because there is only one writer, an increment can be a relaxed load and
+ *  store instead of the locked read-modify-write of fetch_add, which keeps
+ *  counters cheap enough to leave on in hot paths.
+ */
+class Counter {
+public:
+  void
+  add(uint64_t amount) noexcept {
+    value.store(value.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] uint64_t
+  get() const noexcept {
+    return value.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> value = 0;
+};
+
+
+}
+
+
+#endif
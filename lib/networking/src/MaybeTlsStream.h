@@ -0,0 +1,187 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NETWORKING_MAYBE_TLS_STREAM_H
+#define NETWORKING_MAYBE_TLS_STREAM_H
+
+#include <boost/asio.hpp>
+#include <boost/beast/core/stream_traits.hpp>
+#include <boost/beast/websocket/teardown.hpp>
+
+#ifdef NETWORKING_ENABLE_TLS
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/websocket/ssl.hpp>
+#endif
+
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+
+namespace networking {
+
+
+/**
+ *  @class MaybeTlsStream
+ *
+ *  @brief A socket that is either used as is or wrapped in TLS, as decided
+ *  at run time.
+ *
+ *  Plain and encrypted connections then share one stream type, so the HTTP
+ *  and websocket code above does not need to be written twice. A stream
+ *  starts out plain and switches to TLS once startTls() is called, which
+ *  has to happen before any bytes are exchanged. Builds without
+ *  NETWORKING_ENABLE_TLS only have the plain mode.
+ *
+ *  Like the socket it wraps, next_layer() is the bare socket either way, so
+ *  beast::get_lowest_layer() reaches it for timeouts and closing.
+ */
+template <typename Socket>
+class MaybeTlsStream {
+public:
+  using next_layer_type = Socket;
+  using executor_type = typename Socket::executor_type;
+
+  explicit MaybeTlsStream(Socket socket)
+    : plain{std::move(socket)}
+      { }
+
+  template <typename ExecutionContext>
+  requires std::is_convertible_v<ExecutionContext&,
+                                 boost::asio::execution_context&>
+  explicit MaybeTlsStream(ExecutionContext& context)
+    : plain{context}
+      { }
+
+  [[nodiscard]] executor_type
+  get_executor() noexcept {
+    return next_layer().get_executor();
+  }
+
+  [[nodiscard]] Socket&
+  next_layer() noexcept {
+#ifdef NETWORKING_ENABLE_TLS
+    if (tls) {
+      return tls->next_layer();
+    }
+#endif
+    return plain;
+  }
+
+  [[nodiscard]] const Socket&
+  next_layer() const noexcept {
+    return const_cast<MaybeTlsStream&>(*this).next_layer();
+  }
+
+  [[nodiscard]] bool
+  isTls() const noexcept {
+#ifdef NETWORKING_ENABLE_TLS
+    return tls.has_value();
+#else
+    return false;
+#endif
+  }
+
+#ifdef NETWORKING_ENABLE_TLS
+  using tls_stream_type = boost::asio::ssl::stream<Socket>;
+
+  /** Move the socket into a TLS stream. Call once, before the handshake. */
+  void
+  startTls(boost::asio::ssl::context& context) {
+    tls.emplace(std::move(plain), context);
+  }
+
+  [[nodiscard]] tls_stream_type& tlsStream() noexcept { return *tls; }
+#endif
+
+  template <typename MutableBuffers, typename Token>
+  auto
+  async_read_some(const MutableBuffers& buffers, Token&& token) {
+    return boost::asio::async_initiate<Token,
+                                       void(boost::system::error_code, size_t)>(
+      [this](auto handler, const MutableBuffers& buffers) {
+#ifdef NETWORKING_ENABLE_TLS
+        if (tls) {
+          tls->async_read_some(buffers, std::move(handler));
+          return;
+        }
+#endif
+        plain.async_read_some(buffers, std::move(handler));
+      },
+      token, buffers);
+  }
+
+  template <typename ConstBuffers, typename Token>
+  auto
+  async_write_some(const ConstBuffers& buffers, Token&& token) {
+    return boost::asio::async_initiate<Token,
+                                       void(boost::system::error_code, size_t)>(
+      [this](auto handler, const ConstBuffers& buffers) {
+#ifdef NETWORKING_ENABLE_TLS
+        if (tls) {
+          tls->async_write_some(buffers, std::move(handler));
+          return;
+        }
+#endif
+        plain.async_write_some(buffers, std::move(handler));
+      },
+      token, buffers);
+  }
+
+private:
+  Socket plain;
+#ifdef NETWORKING_ENABLE_TLS
+  // Owns the socket once TLS has started, leaving `plain` moved from.
+  std::optional<tls_stream_type> tls;
+#endif
+};
+
+
+// Closing a websocket tears down its next layer, which for TLS includes
+// sending close_notify. Found by argument dependent lookup.
+
+template <typename Socket>
+void
+teardown(boost::beast::role_type role,
+         MaybeTlsStream<Socket>& stream,
+         boost::system::error_code& error) {
+#ifdef NETWORKING_ENABLE_TLS
+  if (stream.isTls()) {
+    using boost::beast::teardown;
+    teardown(role, stream.tlsStream(), error);
+    return;
+  }
+#endif
+  using boost::beast::websocket::teardown;
+  teardown(role, stream.next_layer(), error);
+}
+
+
+template <typename Socket, typename TeardownHandler>
+void
+async_teardown(boost::beast::role_type role,
+               MaybeTlsStream<Socket>& stream,
+               TeardownHandler&& handler) {
+#ifdef NETWORKING_ENABLE_TLS
+  if (stream.isTls()) {
+    using boost::beast::async_teardown;
+    async_teardown(role, stream.tlsStream(),
+                   std::forward<TeardownHandler>(handler));
+    return;
+  }
+#endif
+  using boost::beast::websocket::async_teardown;
+  async_teardown(role, stream.next_layer(),
+                 std::forward<TeardownHandler>(handler));
+}
+
+
+}
+
+
+#endif
@@ -0,0 +1,200 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NETWORKING_OUTBOUND_QUEUE_H
+#define NETWORKING_OUTBOUND_QUEUE_H
+
+#include "Server.h"
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+
+namespace networking {
+
+
+/**
+ *  @class OutboundQueue
+ *
+ *  @brief The messages waiting to be written to one connection, held in one
+ *  FIFO lane per Priority.
+ *
+ *  front() is the oldest message of the highest priority lane that has one,
+ *  with a single exception that keeps bulk transfers moving: once
+ *  `normalPerBulk` Normal messages in a row have been taken while Bulk
+ *  messages were waiting, the next one comes from the Bulk lane. Realtime
+ *  messages are never held back. A weight of zero gives every lane strict
+ *  priority over the lanes below it.
+ *
+ *  When messages have to be discarded, the lowest priority lane gives them
+ *  up first, so congestion is absorbed by bulk traffic.
+ *
+ *  A message may be pushed with a key, in which case it replaces a queued
+ *  message with the same key where that one stands, instead of joining the
+ *  back of its lane. At most one message per key is then ever queued, and
+ *  it is always the newest one.
+ *
+ *  Items only need a view() whose size() is their payload in bytes.
+ */
+template <typename Item>
+class OutboundQueue {
+public:
+  explicit OutboundQueue(unsigned normalPerBulk) noexcept
+    : normalPerBulk{normalPerBulk}
+      { }
+
+  [[nodiscard]] bool empty() const noexcept { return count == 0; }
+  [[nodiscard]] size_t size() const noexcept { return count; }
+  [[nodiscard]] size_t bytes() const noexcept { return totalBytes; }
+
+  /**
+   *  Queues `item`, or with a key that is already queued, puts it in place
+   *  of the queued one and ignores `priority`. Returns whether it replaced.
+   */
+  bool
+  push(Priority priority, Item item, std::optional<uint64_t> key = {}) {
+    totalBytes += item.view().size();
+    if (key) {
+      if (auto found = latest.find(*key); found != latest.end()) {
+        Lane& lane = lanes[found->second.lane];
+        Entry& entry = lane.entries[found->second.sequence - lane.popped];
+        totalBytes -= entry.item.view().size();
+        entry.item = std::move(item);
+        return true;
+      }
+    }
+    const size_t index = static_cast<size_t>(priority);
+    Lane& lane = lanes[index];
+    if (key) {
+      latest.emplace(*key, Slot{index, lane.popped + lane.entries.size()});
+    }
+    lane.entries.push_back({std::move(item), key});
+    ++count;
+    return false;
+  }
+
+  /** The message pop() returns next. The queue must not be empty. */
+  [[nodiscard]] const Item&
+  front() const noexcept {
+    return lanes[nextLane()].entries.front().item;
+  }
+
+  [[nodiscard]] Item
+  pop() {
+    const size_t lane = nextLane();
+    if (lane == NORMAL) {
+      normalStreak = lanes[BULK].empty() ? 0 : normalStreak + 1;
+    } else if (lane == BULK) {
+      normalStreak = 0;
+    }
+    return take(lanes[lane], true);
+  }
+
+  /** Discards the oldest message of the lowest priority lane. */
+  void dropOldest() { take(lanes[lowestLane()], true); }
+
+  /** Discards the newest message of the lowest priority lane. */
+  void dropNewest() { take(lanes[lowestLane()], false); }
+
+  void
+  clear() noexcept {
+    for (auto& lane : lanes) {
+      lane.popped += lane.entries.size();
+      lane.entries.clear();
+    }
+    latest.clear();
+    count = 0;
+    totalBytes = 0;
+    normalStreak = 0;
+  }
+
+private:
+  static constexpr size_t REALTIME = static_cast<size_t>(Priority::Realtime);
+  static constexpr size_t NORMAL = static_cast<size_t>(Priority::Normal);
+  static constexpr size_t BULK = static_cast<size_t>(Priority::Bulk);
+
+  struct Entry {
+    Item item;
+    std::optional<uint64_t> key;
+  };
+
+  struct Lane {
+    std::deque<Entry> entries;
+    // Entries ever removed from the front. Adding it to an entry's index
+    // gives a position that stays put while the lane drains.
+    uint64_t popped = 0;
+
+    [[nodiscard]] bool empty() const noexcept { return entries.empty(); }
+  };
+
+  // Where the queued message for a key stands.
+  struct Slot {
+    size_t lane;
+    uint64_t sequence;
+  };
+
+  [[nodiscard]] size_t
+  nextLane() const noexcept {
+    assert(!empty());
+    if (!lanes[REALTIME].empty()) {
+      return REALTIME;
+    }
+    const bool bulkTurn = normalPerBulk != 0 && normalStreak >= normalPerBulk;
+    if (!lanes[NORMAL].empty() && (lanes[BULK].empty() || !bulkTurn)) {
+      return NORMAL;
+    }
+    return BULK;
+  }
+
+  [[nodiscard]] size_t
+  lowestLane() const noexcept {
+    assert(!empty());
+    size_t lane = lanes.size() - 1;
+    while (lanes[lane].empty()) {
+      --lane;
+    }
+    return lane;
+  }
+
+  Item
+  take(Lane& lane, bool oldest) {
+    Entry entry = std::move(oldest ? lane.entries.front()
+                                   : lane.entries.back());
+    if (oldest) {
+      lane.entries.pop_front();
+      ++lane.popped;
+    } else {
+      lane.entries.pop_back();
+    }
+    if (entry.key) {
+      latest.erase(*entry.key);
+    }
+    totalBytes -= entry.item.view().size();
+    --count;
+    return std::move(entry.item);
+  }
+
+  std::array<Lane, BULK + 1> lanes;
+  std::unordered_map<uint64_t, Slot> latest;
+  size_t count = 0;
+  size_t totalBytes = 0;
+  const unsigned normalPerBulk;
+  unsigned normalStreak = 0;
+};
+
+
+}
+
+
+#endif
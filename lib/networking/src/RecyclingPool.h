@@ -0,0 +1,134 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NETWORKING_RECYCLING_POOL_H
+#define NETWORKING_RECYCLING_POOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+
+namespace networking {
+
+
+/**
+ *  A free list of memory blocks of a single size. Objects that are created
+ *  and destroyed at a high rate but always have the same size, such as the
+ *  shared state of a connection, can take their memory from here instead of
+ *  from the global heap. The block size is fixed by the first block returned.
+ *  Blocks of other sizes pass straight through to operator new and delete.
+ *
+ *  Blocks may be returned from a different thread than the one that took
+ *  them, so the list is guarded by a mutex.
+ */
+class RecyclingPool {
+public:
+  explicit RecyclingPool(size_t maxBlocks)
+    : maxBlocks{maxBlocks} {
+    free.reserve(maxBlocks);
+  }
+
+  ~RecyclingPool() {
+    for (void* block : free) {
+      ::operator delete(block, blockAlignment);
+    }
+  }
+
+  RecyclingPool(const RecyclingPool&) = delete;
+  RecyclingPool(RecyclingPool&&) = delete;
+  RecyclingPool& operator=(const RecyclingPool&) = delete;
+  RecyclingPool& operator=(RecyclingPool&&) = delete;
+
+  [[nodiscard]] void*
+  allocate(size_t size, std::align_val_t alignment) {
+    {
+      std::lock_guard lock{mutex};
+      if (size == blockSize && alignment == blockAlignment && !free.empty()) {
+        void* block = free.back();
+        free.pop_back();
+        return block;
+      }
+    }
+    return ::operator new(size, alignment);
+  }
+
+  void
+  deallocate(void* block, size_t size, std::align_val_t alignment) noexcept {
+    {
+      std::lock_guard lock{mutex};
+      if (blockSize == 0) {
+        blockSize = size;
+        blockAlignment = alignment;
+      }
+      if (size == blockSize && alignment == blockAlignment
+          && free.size() < maxBlocks) {
+        free.push_back(block);
+        return;
+      }
+    }
+    ::operator delete(block, alignment);
+  }
+
+private:
+  const size_t maxBlocks;
+
+  std::mutex mutex;
+  size_t blockSize = 0;
+  std::align_val_t blockAlignment{alignof(std::max_align_t)};
+  std::vector<void*> free;
+};
+
+
+/**
+ *  A standard allocator drawing from a RecyclingPool, for use with
+ *  std::allocate_shared and other allocator aware facilities.
+ */
+template <typename T>
+class RecyclingAllocator {
+public:
+  using value_type = T;
+
+  explicit RecyclingAllocator(RecyclingPool& pool) noexcept
+    : pool{&pool}
+      { }
+
+  template <typename U>
+  RecyclingAllocator(const RecyclingAllocator<U>& other) noexcept
+    : pool{other.getPool()}
+      { }
+
+  [[nodiscard]] T*
+  allocate(size_t count) {
+    return static_cast<T*>(pool->allocate(count * sizeof(T),
+                                          std::align_val_t{alignof(T)}));
+  }
+
+  void
+  deallocate(T* block, size_t count) noexcept {
+    pool->deallocate(block, count * sizeof(T), std::align_val_t{alignof(T)});
+  }
+
+  [[nodiscard]] RecyclingPool* getPool() const noexcept { return pool; }
+
+  template <typename U>
+  bool
+  operator==(const RecyclingAllocator<U>& other) const noexcept {
+    return pool == other.getPool();
+  }
+
+private:
+  RecyclingPool* pool;
+};
+
+
+}
+
+
+#endif
@@ -14,6 +14,18 @@
 
 
 #include "Server.h"
+#include "BufferPool.h"
+#include "CoalescingStream.h"
+#include "Compression.h"
+#include "Counter.h"
+#include "MaybeTlsStream.h"
+#include "OutboundQueue.h"
+#include "RecyclingPool.h"
+#include "SlotMap.h"
+#include "StaticFiles.h"
+#include "TimerWheel.h"
+#include "TokenBucket.h"
+#include "Wakeup.h"
 
 
 #include <boost/asio.hpp>
@@ -21,12 +33,32 @@
 #include <boost/asio/experimental/awaitable_operators.hpp>
 #include <boost/beast.hpp>
 
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+#include <sys/stat.h>
+#endif
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <exception>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 
 namespace asio = boost::asio;
@@ -42,9 +74,12 @@ using namespace std::chrono_literals;
 
 using networking::Connection;
 using networking::Message;
+using networking::MessageType;
 using networking::Server;
 using networking::ServerImpl;
 using networking::ServerImplDeleter;
+using networking::ServerOptions;
+using networking::ServerStats;
 
 
 namespace networking {
@@ -53,62 +88,480 @@ namespace networking {
 class Channel;
 
 
+// TCP and Unix domain sockets share all of the code after accept, and so do
+// plain and TLS connections.
+using StreamSocket = asio::generic::stream_protocol::socket;
+using StreamAcceptor =
+  asio::basic_socket_acceptor<asio::generic::stream_protocol>;
+using TransportStream = MaybeTlsStream<StreamSocket>;
+
+
+// Receive buffers that grew past this size are freed rather than pooled, so
+// an occasional huge message does not stay resident.
+static constexpr size_t MAX_POOLED_BUFFER_BYTES = 1024 * 1024;
+
+// How much connection state each shard keeps around for reuse, so that a
+// burst of reconnects does not go back to the global heap.
+static constexpr size_t MAX_POOLED_CHANNELS = 256;
+static constexpr size_t MAX_SPARE_SIGNALS = 256;
+
+// Idle deadlines are tracked in ticks of an eighth of the idle timeout,
+// within these bounds, on a wheel spanning this many ticks.
+static constexpr std::chrono::nanoseconds MIN_IDLE_TICK = 10ms;
+static constexpr std::chrono::nanoseconds MAX_IDLE_TICK = 1s;
+static constexpr size_t IDLE_WHEEL_SLOTS = 256;
+
+// Static files are streamed in pieces of at most this size, yielding to the
+// shard's other work in between.
+static constexpr size_t MAX_SENDFILE_CHUNK = 256 * 1024;
+
+// Threads that look up static files, since stats and reads of files that
+// are not cached block.
+static constexpr size_t STATIC_FILE_THREADS = 2;
+
+// Error descriptions held for ServerOptions::onError between updates.
+static constexpr size_t MAX_PENDING_ERRORS = 64;
+
+
+// An outbound message. A broadcast shares one immutable payload between all
+// of its recipients, while a unicast send owns its text outright and so
+// avoids the reference count.
+struct Outgoing {
+  std::shared_ptr<const std::string> shared;
+  std::string owned;
+  MessageType type = MessageType::Text;
+  Priority priority = Priority::Normal;
+  // Set by Server::sendLatest(), which replaces a queued message of the key.
+  std::optional<uint64_t> key;
+
+  [[nodiscard]] std::string_view
+  view() const noexcept {
+    return shared ? std::string_view{*shared} : std::string_view{owned};
+  }
+};
+
+
+// Message and payload byte counts in both directions. Each counter is only
+// written by the thread of the shard that owns the connections counted.
+struct TrafficCounters {
+  Counter messagesIn;
+  Counter bytesIn;
+  Counter messagesOut;
+  Counter bytesOut;
+
+  void
+  countIn(uint64_t bytes) noexcept {
+    messagesIn.add(1);
+    bytesIn.add(bytes);
+  }
+
+  void
+  countOut(uint64_t bytes) noexcept {
+    messagesOut.add(1);
+    bytesOut.add(bytes);
+  }
+};
+
+
+// One admitted TCP connection, counted against AdmissionLimits while the
+// ticket lives. It follows the socket from the HTTP session into its Channel.
+class AdmissionTicket {
+public:
+  AdmissionTicket() = default;
+
+  explicit AdmissionTicket(std::atomic<size_t>& open) noexcept
+    : open{&open} {
+    open.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  AdmissionTicket(AdmissionTicket&& other) noexcept
+    : open{std::exchange(other.open, nullptr)}
+    { }
+
+  AdmissionTicket&
+  operator=(AdmissionTicket&& other) noexcept {
+    std::swap(open, other.open);
+    return *this;
+  }
+
+  ~AdmissionTicket() {
+    if (open) {
+      open->fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+private:
+  std::atomic<size_t>* open = nullptr;
+};
+
+
+// Something a shard reports back to the thread calling Server::update().
+// Received and Overflowed events refer to their channel by raw pointer. That
+// is safe because the channel's Disconnected event, which owns it, is always
+// queued after them: nothing is received once the channel has finished, and
+// sends that reach it afterwards are dropped without overflowing.
+struct ShardEvent {
+  enum class Kind { Connected, Received, Overflowed, Disconnected };
+
+  Kind kind;
+  Channel* channel;
+  std::shared_ptr<Channel> owner;
+  std::string text;
+  MessageType type = MessageType::Text;
+  bool endOfMessage = true;
+};
+
+
 /////////////////////////////////////////////////////////////////////////////
-// Private Server API
+// Shards (an event loop and the connections it serves)
 /////////////////////////////////////////////////////////////////////////////
 
 
-class ServerImpl {
+// A shard owns one io_context and every coroutine running on it. The inline
+// shard of a default Server is driven by Server::update() on the caller's
+// thread. Threaded shards run on their own thread and queue their events for
+// the next update() instead of invoking callbacks themselves.
+class Shard {
 public:
-  using ChannelMap =
-    std::unordered_map<Connection, std::shared_ptr<Channel>, ConnectionHash>;
+  Shard(ServerImpl& serverImpl, size_t index, bool threaded);
 
-  ServerImpl(Server& server, unsigned short port, std::string httpMessage);
-  ~ServerImpl();
+  Shard(const Shard&) = delete;
+  Shard(Shard&&) = delete;
+  Shard& operator=(const Shard&) = delete;
+  Shard& operator=(Shard&&) = delete;
+
+  // Identifies a tracked coroutine. Ids of finished tasks are never reused,
+  // so cancelling one of those is harmless.
+  using TaskId = SlotMap<std::unique_ptr<asio::cancellation_signal>>::Key;
 
   // Spawn a coroutine whose lifetime is tracked in activeTasks so that the
   // destructor can cancel it and then run the context until it has provably
-  // completed. Returns the signal used to request cancellation.
+  // completed. Must be called on the shard's own thread.
   template <typename Task, typename OnDone>
-  std::shared_ptr<asio::cancellation_signal>
-  spawnTracked(Task&& task, OnDone onDone) {
-    const uint64_t id = nextTaskId++;
-    auto signal = std::make_shared<asio::cancellation_signal>();
-    activeTasks.emplace(id, signal);
-    asio::co_spawn(ioContext, std::forward<Task>(task),
-      asio::bind_cancellation_slot(signal->slot(),
-        [this, id, onDone = std::move(onDone)](std::exception_ptr error) {
-          if (error) {
-            reportError("Coroutine ended with an exception");
-          }
-          activeTasks.erase(id);
-          onDone();
-        }));
-    return signal;
+  TaskId spawnTracked(Task&& task, OnDone onDone);
+
+  // Request cancellation of a tracked coroutine, if it is still running.
+  // Must be called on the shard's own thread.
+  void cancelTask(TaskId task);
+
+  // Run `work` on this shard's thread: immediately when the shard is inline,
+  // otherwise by posting it to the shard's context.
+  template <typename Work>
+  void
+  execute(Work&& work) {
+    if (isThreaded()) {
+      asio::post(ioContext, std::forward<Work>(work));
+    } else {
+      std::forward<Work>(work)();
+    }
+  }
+
+  void deliver(ShardEvent event);
+  void takeEvents(std::vector<ShardEvent>& batch);
+
+  // Idle deadlines of this shard's channels. They all live on one timer
+  // wheel that a single timer advances, so traffic never touches a timer and
+  // each channel is only visited a few times per idle period. Only used when
+  // TimeoutOptions::idle is set.
+  using IdleKey = SlotMap<Channel*>::Key;
+  using Tick = TimerWheel<IdleKey>::Tick;
+
+  struct IdleLimits {
+    std::chrono::nanoseconds tick{0};
+    // All in ticks. The timeout is zero when idle checks are disabled, and
+    // the ping is zero without keepalive pings.
+    Tick timeout = 0;
+    Tick ping = 0;
+    Tick checkEvery = 0;
+  };
+
+  // Keeps a channel on the idle wheel for as long as the watch lives.
+  class IdleWatch {
+  public:
+    IdleWatch(Shard& shard, Channel& channel)
+      : shard{shard},
+        key{shard.idleChannels.insert(&channel)} {
+      shard.idleWheel.schedule(key, shard.idleLimits.checkEvery);
+    }
+    ~IdleWatch() { shard.idleChannels.erase(key); }
+
+    IdleWatch(const IdleWatch&) = delete;
+    IdleWatch& operator=(const IdleWatch&) = delete;
+
+  private:
+    Shard& shard;
+    IdleKey key;
+  };
+
+  [[nodiscard]] const IdleLimits& getIdleLimits() const noexcept { return idleLimits; }
+  [[nodiscard]] Tick idleNow() const noexcept { return idleWheel.now(); }
+
+  // Advances the idle wheel one tick at a time until cancelled.
+  awaitable<void> sweepIdle();
+
+  void startThread();
+  void stopThread();
+  void drain();
+
+  [[nodiscard]] bool isThreaded() const noexcept { return threaded; }
+  [[nodiscard]] size_t getIndex() const noexcept { return index; }
+
+  ServerImpl& serverImpl;
+
+  // Memory for the Channels of this shard. Declared before the context so
+  // that it outlives any handler still holding a Channel.
+  RecyclingPool channelPool{MAX_POOLED_CHANNELS};
+
+  asio::io_context ioContext{1};
+
+  // Written only on the shard's thread, readable from any thread.
+  CompressionMeter compression;
+  TrafficCounters traffic;
+  Counter accepted;
+  Counter acceptErrors;
+  Counter rejectedOverCapacity;
+  Counter rejectedOverRate;
+  Counter tlsHandshakes;
+  Counter tlsResumedHandshakes;
+  Counter tlsHandshakeErrors;
+  Counter supersededMessages;
+
+private:
+  void cancelTasks();
+
+  const size_t index;
+  const bool threaded;
+
+  const IdleLimits idleLimits;
+  SlotMap<Channel*> idleChannels;
+  TimerWheel<IdleKey> idleWheel{IDLE_WHEEL_SLOTS};
+
+  // Signals are recycled between tasks rather than allocated per task.
+  SlotMap<std::unique_ptr<asio::cancellation_signal>> activeTasks;
+  std::vector<std::unique_ptr<asio::cancellation_signal>> spareSignals;
+
+  std::optional<asio::executor_work_guard<asio::io_context::executor_type>>
+    workGuard;
+  std::thread thread;
+
+  std::mutex eventMutex;
+  std::vector<ShardEvent> events;
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Precomputed index page
+/////////////////////////////////////////////////////////////////////////////
+
+
+/**
+ *  The httpMessage page as complete HTTP/1.1 responses, serialized once when
+ *  the Server starts. Each response's header is a prefix of its bytes, so a
+ *  HEAD request is answered from the same buffer. A gzip encoded variant is
+ *  kept only when compressing succeeds and makes the page smaller.
+ */
+class IndexResponses {
+public:
+  struct Response {
+    std::string bytes;
+    size_t headerSize = 0;
+  };
+
+  explicit IndexResponses(std::string_view page) {
+    const auto compressed = gzip(page);
+    hasGzip = compressed && compressed->size() < page.size();
+    for (bool keepAlive : {false, true}) {
+      plain[keepAlive] = serialize(page, false, keepAlive);
+      if (hasGzip) {
+        gzipped[keepAlive] = serialize(*compressed, true, keepAlive);
+      }
+    }
+  }
+
+  [[nodiscard]] const Response&
+  select(bool acceptsGzip, bool keepAlive) const noexcept {
+    return (acceptsGzip && hasGzip) ? gzipped[keepAlive] : plain[keepAlive];
   }
 
-  awaitable<void> acceptLoop();
-  awaitable<void> httpSession(asio::ip::tcp::socket socket);
-  void startChannel(asio::ip::tcp::socket socket,
+private:
+  Response
+  serialize(std::string_view body, bool isGzip, bool keepAlive) const {
+    http::response<http::empty_body> response{http::status::ok, 11};
+    response.set(http::field::content_type, "text/html");
+    if (isGzip) {
+      response.set(http::field::content_encoding, "gzip");
+    }
+    if (hasGzip) {
+      response.set(http::field::vary, "Accept-Encoding");
+    }
+    response.keep_alive(keepAlive);
+    response.content_length(body.size());
+
+    std::ostringstream header;
+    header << response.base();
+    Response serialized{header.str(), 0};
+    serialized.headerSize = serialized.bytes.size();
+    serialized.bytes.append(body);
+    return serialized;
+  }
+
+  bool hasGzip = false;
+  Response plain[2];
+  Response gzipped[2];
+};
+
+
+/**
+ *  Tells one file apart from another that later takes its path.
+ */
+struct FileIdentity {
+  uint64_t device;
+  uint64_t inode;
+
+  bool operator==(const FileIdentity&) const = default;
+};
+
+
+static std::optional<FileIdentity>
+identifyFile(const std::filesystem::path& path) {
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+  struct stat status;
+  if (::stat(path.c_str(), &status) == 0) {
+    return FileIdentity{static_cast<uint64_t>(status.st_dev),
+                        static_cast<uint64_t>(status.st_ino)};
+  }
+#else
+  (void)path;
+#endif
+  return std::nullopt;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Private Server API
+/////////////////////////////////////////////////////////////////////////////
+
+
+class ServerImpl {
+public:
+  // Keyed by Connection::id, which is a SlotMap key. Lookups by Connection
+  // are an array access, and broadcasts walk the channels contiguously.
+  using ChannelMap = SlotMap<std::shared_ptr<Channel>>;
+
+  ServerImpl(Server& server,
+             unsigned short port,
+             std::string httpMessage,
+             ServerOptions options);
+  ~ServerImpl();
+
+  awaitable<void> acceptLoop(StreamAcceptor& acceptor);
+  // Turns the socket away with a 503, without waiting on the peer.
+  void rejectConnection(StreamSocket& socket);
+  awaitable<void> httpSession(Shard& shard,
+                              StreamSocket socket,
+                              AdmissionTicket ticket);
+  // Returns false if the connection should be dropped.
+  awaitable<bool> handshakeTls(Shard& shard, TransportStream& stream);
+  // Each returns false if the response could not be written in full, after
+  // which the connection cannot carry another request.
+  awaitable<bool> respond(TransportStream& stream,
+                          const http::request<http::string_body>& request);
+  awaitable<std::shared_ptr<const StaticFiles::File>>
+  findStaticFile(std::string target);
+  awaitable<bool>
+  sendStaticFile(TransportStream& stream,
+                 const http::request<http::string_body>& request,
+                 const StaticFiles::File& file);
+  void startChannel(Shard& shard,
+                    TransportStream stream,
+                    AdmissionTicket ticket,
                     http::request<http::string_body> request);
 
+  // Update-thread bookkeeping. In inline mode these are called directly by
+  // the channels; in threaded mode they run when update() applies events.
+  void applyEvent(ShardEvent& event);
   void registerChannel(std::shared_ptr<Channel> channel);
-  void channelDone(Connection connection);
-  void reportError(std::string_view message);
+  void channelDone(Channel& channel);
+  void reportOverflow(Connection connection);
+
+  // Wakes an update(maxWait) blocked on threaded shards.
+  void notifyEvents();
+  void waitForEvents(std::chrono::nanoseconds maxWait);
+
+  // Queue a message for a channel. Messages bound for threaded shards are
+  // batched per shard and handed over when flushSends() is called.
+  void enqueue(const std::shared_ptr<Channel>& channel, Outgoing message);
+  void flushSends();
+
+  // Settles received messages about to be handed to the application with
+  // their channels, resuming any reader that was waiting for them.
+  void markDelivered(const std::vector<Message>& messages);
+
+  // Both may be called from any shard's thread.
+  void reportError(std::string message);
+  void reportException(std::string_view where, std::exception_ptr error);
+  void deliverErrors();
 
   Server& server;
-  asio::io_context ioContext{};
-  asio::ip::tcp::acceptor acceptor;
+  const ServerOptions options;
+  // Admitted sockets still open, across all shards. Declared before the
+  // shards so that it outlives every ticket they hold.
+  std::atomic<size_t> openConnections = 0;
+  std::vector<std::unique_ptr<Shard>> shards;
+  unsigned short boundPort = 0;
+  // The TCP listener first, then the Unix domain socket if one was asked for.
+  std::vector<StreamAcceptor> acceptors;
+  // The socket file this Server bound, which it alone may remove.
+  std::optional<FileIdentity> unixSocketFile;
   http::string_body::value_type httpMessage;
+  const IndexResponses indexResponses;
+  std::optional<StaticFiles> staticFiles;
+  // Runs the blocking part of static file lookups. Declared after the shards
+  // so that it is joined before their contexts go away.
+  std::optional<asio::thread_pool> fileWorkers;
+#ifdef NETWORKING_ENABLE_TLS
+  std::optional<asio::ssl::context> tlsContext;
+#endif
 
-  uintptr_t nextConnectionId = 1;
-  uint64_t nextTaskId = 1;
-  std::unordered_map<uint64_t, std::shared_ptr<asio::cancellation_signal>>
-    activeTasks;
-  bool stopping = false;
+  size_t nextShard = 0;
+  TokenBucket acceptRate;
+  std::atomic<bool> stopping = false;
 
   ChannelMap channels;
-  std::deque<Message> incoming;
+  // A vector rather than a deque so that receiveInto() can swap it with the
+  // caller's vector and both keep their capacity from tick to tick.
+  std::vector<Message> incoming;
+  BufferPool receiveBuffers;
+
+  // An inline shard detects overflows in the middle of Server::send(), where
+  // the callback cannot run. They are reported by the next update() instead.
+  std::vector<Connection> overflowed;
+  std::vector<Connection> overflowBatch;
+
+  std::vector<std::vector<std::pair<std::shared_ptr<Channel>, Outgoing>>>
+    pendingSends;
+  std::vector<ShardEvent> eventBatch;
+
+  std::mutex wakeMutex;
+  std::condition_variable wakeCondition;
+  bool eventsPending = false;
+
+  std::atomic<uint64_t> handlerErrors = 0;
+  std::mutex errorMutex;
+  std::vector<std::string> pendingErrors;
+  std::vector<std::string> errorBatch;
+
+  // Update-thread statistics. Shards keep their own counters.
+  uint64_t closedConnections = 0;
+  uint64_t updates = 0;
+  uint64_t lastUpdateHandlers = 0;
+  uint64_t totalUpdateHandlers = 0;
+  std::chrono::nanoseconds lastUpdateTime{0};
+  std::chrono::nanoseconds totalUpdateTime{0};
+
+  // Readable while threaded shards have queued events. Inline servers do
+  // their I/O inside update() and have nothing to signal.
+  std::optional<Wakeup> wakeup;
 };
 
 
@@ -117,17 +570,43 @@ public:
 /////////////////////////////////////////////////////////////////////////////
 
 
+namespace {
+
+
+// Beast decides whether to compress a message by the size of its first
+// frame, so fragments must not be smaller than the compression threshold.
+size_t
+makeFragmentBytes(const ServerOptions& options) {
+  if (options.sendFragmentBytes == 0 || !options.compression.enabled) {
+    return options.sendFragmentBytes;
+  }
+  return std::max(options.sendFragmentBytes,
+                  options.compression.minMessageSize);
+}
+
+
+}
+
+
 class Channel {
 public:
-  Channel(asio::ip::tcp::socket socket,
-          Connection connection,
-          ServerImpl& serverImpl)
-    : connection{connection},
-      serverImpl{serverImpl},
-      websocket{std::move(socket)},
+  Channel(TransportStream stream, AdmissionTicket ticket, Shard& shard)
+    : shard{shard},
+      ticket{std::move(ticket)},
+      writeBatchBytes{shard.serverImpl.options.writeBatchBytes},
+      sendFragmentBytes{makeFragmentBytes(shard.serverImpl.options)},
+      limits{shard.serverImpl.options.outboundLimits},
+      maxUndeliveredBytes{shard.serverImpl.options.receive.maxUndeliveredBytes},
+      websocket{std::move(stream)},
       wakeTimer{websocket.get_executor(),
-                std::chrono::steady_clock::time_point::max()}
-      { }
+                std::chrono::steady_clock::time_point::max()},
+      outbound{shard.serverImpl.options.normalPerBulk},
+      resumeTimer{websocket.get_executor(),
+                  std::chrono::steady_clock::time_point::max()} {
+    websocket.set_option(toDeflateOption(shard.serverImpl.options.compression));
+    websocket.read_message_max(
+      shard.serverImpl.options.receive.maxMessageBytes);
+  }
 
   // The parent coroutine owning this connection: accept the websocket,
   // register, run reader and writer until either finishes (which cancels
@@ -135,37 +614,98 @@ public:
   [[nodiscard]] awaitable<void>
   run(std::shared_ptr<Channel> self, http::request<http::string_body> request);
 
-  void send(std::string message);
+  void send(Outgoing message);
   void requestStop();
 
+  // Called on the shard's thread once run() has completed, right before the
+  // Disconnected event is queued.
+  void finish() noexcept { finished = true; }
+
+  // Called from the update thread as received bytes reach the application.
+  // Returns true when that brings them back under the limit, after which
+  // resumeReading() must be called on the shard's thread.
+  [[nodiscard]] bool delivered(size_t bytes) noexcept;
+  void resumeReading() { resumeTimer.cancel_one(); }
+
+  // The Connection is assigned on registration by the thread calling
+  // Server::update(), and only that thread may read it.
   [[nodiscard]] Connection getConnection() const noexcept { return connection; }
+  void setConnection(Connection assigned) noexcept { connection = assigned; }
+
+  [[nodiscard]] Shard& getShard() const noexcept { return shard; }
 
-  void setStopSignal(std::shared_ptr<asio::cancellation_signal> signal) {
-    stopSignal = std::move(signal);
+  [[nodiscard]] const TrafficCounters& getTraffic() const noexcept { return traffic; }
+
+  [[nodiscard]] QueueDepth
+  getQueueDepth() const noexcept {
+    return {queuedMessages.load(std::memory_order_relaxed),
+            queuedBytes.load(std::memory_order_relaxed)};
   }
 
+  void setTask(Shard::TaskId id) noexcept { task = id; }
+
+  // Called by the shard's idle wheel with the current tick. Returns the
+  // ticks until the next check, or zero once the channel has been stopped.
+  [[nodiscard]] Shard::Tick checkIdle(Shard::Tick now);
+
 private:
   [[nodiscard]] awaitable<void> reader();
   [[nodiscard]] awaitable<void> writer();
+  [[nodiscard]] awaitable<std::tuple<boost::system::error_code, size_t>>
+  writeMessage(const Outgoing& message, bool metered);
 
-  Connection connection;
-  ServerImpl& serverImpl;
+  [[nodiscard]] bool overLimits() const noexcept;
+  void applyOverflowPolicy();
+  void publishQueueDepth() noexcept;
 
-  websock::stream<asio::ip::tcp::socket> websocket;
+  Connection connection{0};
+  Shard& shard;
+  AdmissionTicket ticket;
+  const size_t writeBatchBytes;
+  const size_t sendFragmentBytes;
+  const OutboundLimits limits;
+  const size_t maxUndeliveredBytes;
+
+  websock::stream<CoalescingStream<TransportStream>> websocket;
 
   // The timer is parked forever and cancelled to signal "queue is not empty".
   asio::steady_timer wakeTimer;
-  std::deque<std::string> outbound;
-
-  std::shared_ptr<asio::cancellation_signal> stopSignal;
+  OutboundQueue<Outgoing> outbound;
+  bool droppedForOverflow = false;
+  bool finished = false;
+
+  // Received bytes not yet taken by the application. The reader parks on the
+  // timer while they are at the limit, and is woken the same way as the
+  // writer once they no longer are.
+  std::atomic<size_t> undeliveredBytes = 0;
+  asio::steady_timer resumeTimer;
+
+  // Mirrors of the outbound queue's size, written only on the shard's thread
+  // so that Server::queueDepth() can read them from the update thread.
+  std::atomic<size_t> queuedMessages = 0;
+  std::atomic<size_t> queuedBytes = 0;
+  TrafficCounters traffic;
+
+  // The tracked coroutine running this channel, cancelled by requestStop().
+  Shard::TaskId task = 0;
+
+  // Idle tracking. The peer is heard from whenever the transport's read
+  // count has moved since the previous check.
+  uint64_t lastBytesRead = 0;
+  Shard::Tick lastHeard = 0;
+  bool pingSent = false;
+  bool pingDue = false;
 };
 
 
 awaitable<void>
 Channel::run(std::shared_ptr<Channel> self,
              http::request<http::string_body> request) {
-  auto [acceptError] =
-    co_await websocket.async_accept(request, as_tuple(use_awaitable));
+  const auto handshakeTimeout = shard.serverImpl.options.timeouts.handshake;
+  auto [acceptError] = handshakeTimeout > 0ms
+    ? co_await websocket.async_accept(request,
+        asio::cancel_after(handshakeTimeout, as_tuple(use_awaitable)))
+    : co_await websocket.async_accept(request, as_tuple(use_awaitable));
   if (acceptError) {
     co_return;
   }
@@ -174,11 +714,19 @@ Channel::run(std::shared_ptr<Channel> self,
   // ~ServerImpl has begun tearing down. Once stopping, no user callbacks may
   // fire, so skip registration (and the handleConnect it would trigger)
   // rather than run during the destructor.
-  if (serverImpl.stopping) {
+  if (shard.serverImpl.stopping) {
     co_return;
   }
 
-  serverImpl.registerChannel(std::move(self));
+  shard.deliver({ShardEvent::Kind::Connected, this, std::move(self), {}});
+
+  // Only registered channels are watched, so that an idle timeout always
+  // has a disconnect to report.
+  std::optional<Shard::IdleWatch> idleWatch;
+  if (shard.getIdleLimits().timeout != 0) {
+    lastHeard = shard.idleNow();
+    idleWatch.emplace(shard, *this);
+  }
 
   co_await (reader() || writer());
 
@@ -197,193 +745,432 @@ Channel::run(std::shared_ptr<Channel> self,
 
 awaitable<void>
 Channel::reader() {
-  beast::flat_buffer buffer;
+  auto& pool = shard.serverImpl.receiveBuffers;
+  const ReceiveOptions& receive = shard.serverImpl.options.receive;
+  auto cancelState = co_await asio::this_coro::cancellation_state;
   while (true) {
-    auto [error, bytes] =
-      co_await websocket.async_read(buffer, as_tuple(use_awaitable));
-    (void)bytes;
+    // An application that falls behind holds the peer back, instead of
+    // letting its messages pile up in memory.
+    while (maxUndeliveredBytes != 0
+           && undeliveredBytes.load(std::memory_order_acquire)
+                >= maxUndeliveredBytes) {
+      co_await resumeTimer.async_wait(as_tuple(use_awaitable));
+      if (cancelState.cancelled() != asio::cancellation_type::none) {
+        co_return;
+      }
+    }
+
+    // Each message or fragment is read into its own pooled buffer, which
+    // then travels to the application without being copied.
+    std::string text = pool.acquire();
+    auto buffer = asio::dynamic_buffer(text);
+    auto [error, bytes] = receive.streaming
+      ? co_await websocket.async_read_some(buffer, receive.fragmentBytes,
+                                           as_tuple(use_awaitable))
+      : co_await websocket.async_read(buffer, as_tuple(use_awaitable));
     if (error) {
+      pool.release(std::move(text));
       co_return;
     }
-    serverImpl.incoming.push_back(
-      {connection, beast::buffers_to_string(buffer.data())});
-    buffer.consume(buffer.size());
+
+    // Messages are counted once, when their last fragment arrives.
+    const bool endOfMessage = websocket.is_message_done();
+    if (endOfMessage) {
+      traffic.countIn(bytes);
+      shard.traffic.countIn(bytes);
+    } else if (bytes == 0) {
+      // An empty frame in the middle of a message carries nothing.
+      pool.release(std::move(text));
+      continue;
+    } else {
+      traffic.bytesIn.add(bytes);
+      shard.traffic.bytesIn.add(bytes);
+    }
+    undeliveredBytes.fetch_add(text.size(), std::memory_order_acq_rel);
+    shard.deliver({ShardEvent::Kind::Received, this, nullptr, std::move(text),
+                   websocket.got_binary() ? MessageType::Binary
+                                          : MessageType::Text,
+                   endOfMessage});
   }
 }
 
 
 awaitable<void>
 Channel::writer() {
+  auto& transport = websocket.next_layer();
+  const bool metered = shard.serverImpl.options.compression.enabled;
   auto cancelState = co_await asio::this_coro::cancellation_state;
   while (cancelState.cancelled() == asio::cancellation_type::none) {
+    if (pingDue) {
+      pingDue = false;
+      auto [error] =
+        co_await websocket.async_ping({}, as_tuple(use_awaitable));
+      if (error) {
+        co_return;
+      }
+      continue;
+    }
+
     if (outbound.empty()) {
-      // Park until send() cancels the timer or cancelled.
+      // Park until send() or a due ping cancels the timer, or cancelled.
       // The loop condition distinguishes the two.
       co_await wakeTimer.async_wait(as_tuple(use_awaitable));
       continue;
     }
-    std::string message = std::move(outbound.front());
-    outbound.pop_front();
-    auto [error, bytes] =
-      co_await websocket.async_write(asio::buffer(message),
-                                     as_tuple(use_awaitable));
-    (void)bytes;
-    if (error) {
-      co_return;
+
+    // Frame as many queued messages as fit in the batch budget into the
+    // corked transport, then send them with one write. A message larger than
+    // the budget on its own goes straight to the socket, without the copy.
+    const bool batched = outbound.front().view().size() < writeBatchBytes;
+    if (batched) {
+      transport.cork();
+    }
+    size_t batchBytes = 0;
+    do {
+      Outgoing message = outbound.pop();
+      publishQueueDepth();
+      batchBytes += message.view().size();
+      const auto wireBefore = transport.bytesWritten();
+      auto [error, bytes] = co_await writeMessage(message, metered);
+      if (error) {
+        transport.abandon();
+        co_return;
+      }
+      traffic.countOut(bytes);
+      shard.traffic.countOut(bytes);
+      if (metered) {
+        shard.compression.record(bytes, transport.bytesWritten() - wireBefore,
+                                 transport.takeCpuTime());
+      }
+    } while (batched && !outbound.empty()
+             && batchBytes + outbound.front().view().size() <= writeBatchBytes);
+
+    if (transport.isCorked()) {
+      auto [error] = co_await transport.async_flush(as_tuple(use_awaitable));
+      if (error) {
+        co_return;
+      }
     }
   }
 }
 
 
-void
-Channel::send(std::string message) {
-  if (message.empty()) {
-    return;
+awaitable<std::tuple<boost::system::error_code, size_t>>
+Channel::writeMessage(const Outgoing& message, bool metered) {
+  // Only the synchronous parts of each write are metered, which is where
+  // deflate runs, not the time the write waits while other handlers run.
+  auto& transport = websocket.next_layer();
+  const std::string_view payload = message.view();
+  websocket.binary(message.type == MessageType::Binary);
+  if (sendFragmentBytes == 0 || payload.size() <= sendFragmentBytes) {
+    if (metered) {
+      transport.meterCpu();
+    }
+    auto result = co_await websocket.async_write(asio::buffer(payload),
+                                                 as_tuple(use_awaitable));
+    transport.pauseCpuMeter();
+    co_return result;
+  }
+
+  // Each write_some() takes and releases the stream on its own, so a pong or
+  // close the reader has waiting goes out before the next fragment instead
+  // of after the whole message.
+  size_t offset = 0;
+  while (true) {
+    const size_t length = std::min(sendFragmentBytes, payload.size() - offset);
+    const bool last = offset + length == payload.size();
+    if (metered) {
+      transport.meterCpu();
+    }
+    auto [error, bytes] =
+      co_await websocket.async_write_some(last,
+                                          asio::buffer(payload.substr(offset,
+                                                                      length)),
+                                          as_tuple(use_awaitable));
+    transport.pauseCpuMeter();
+    offset += bytes;
+    if (error || last) {
+      co_return std::tuple{error, offset};
+    }
+    if (pingDue) {
+      pingDue = false;
+      auto [pingError] =
+        co_await websocket.async_ping({}, as_tuple(use_awaitable));
+      if (pingError) {
+        co_return std::tuple{pingError, offset};
+      }
+    }
+    // Let the reader and the shard's other connections run between frames.
+    co_await asio::post(websocket.get_executor(), use_awaitable);
   }
-  outbound.push_back(std::move(message));
-  wakeTimer.cancel_one();
 }
 
 
 void
-Channel::requestStop() {
-  if (stopSignal) {
-    stopSignal->emit(asio::cancellation_type::terminal);
+Channel::send(Outgoing message) {
+  // Sends posted from a threaded update() may arrive after the channel has
+  // finished. Nothing would drain them, and an overflow reported for them
+  // could outlive the channel.
+  if (message.view().empty() || droppedForOverflow || finished) {
+    return;
+  }
+  const Priority priority = message.priority;
+  const auto key = message.key;
+  if (outbound.push(priority, std::move(message), key)) {
+    shard.supersededMessages.add(1);
   }
+  if (overLimits()) {
+    applyOverflowPolicy();
+    shard.deliver({ShardEvent::Kind::Overflowed, this, nullptr, {}});
+  }
+  publishQueueDepth();
+  wakeTimer.cancel_one();
 }
 
 
-/////////////////////////////////////////////////////////////////////////////
-// Basic HTTP Request Handling
-/////////////////////////////////////////////////////////////////////////////
+bool
+Channel::delivered(size_t bytes) noexcept {
+  const size_t before =
+    undeliveredBytes.fetch_sub(bytes, std::memory_order_acq_rel);
+  return maxUndeliveredBytes != 0
+      && before >= maxUndeliveredBytes
+      && before - bytes < maxUndeliveredBytes;
+}
 
 
-awaitable<void>
-ServerImpl::httpSession(asio::ip::tcp::socket socket) {
-  beast::flat_buffer buffer;
-  http::request<http::string_body> request;
+bool
+Channel::overLimits() const noexcept {
+  return (limits.maxQueuedMessages != 0
+          && outbound.size() > limits.maxQueuedMessages)
+      || (limits.maxQueuedBytes != 0
+          && outbound.bytes() > limits.maxQueuedBytes);
+}
 
-  auto [readError, readBytes] =
-    co_await http::async_read(socket, buffer, request, as_tuple(use_awaitable));
-  (void)readBytes;
-  if (readError) {
-    co_return;
-  }
 
-  if (websock::is_upgrade(request)) {
-    startChannel(std::move(socket), std::move(request));
-    co_return;
+void
+Channel::applyOverflowPolicy() {
+  switch (limits.policy) {
+    case OverflowPolicy::DropNewest:
+      // A high priority message can displace several smaller ones below it.
+      while (!outbound.empty() && overLimits()) {
+        outbound.dropNewest();
+      }
+      break;
+    case OverflowPolicy::DropOldest:
+      // A message that exceeds the byte limit on its own is dropped as well.
+      while (!outbound.empty() && overLimits()) {
+        outbound.dropOldest();
+      }
+      break;
+    case OverflowPolicy::Disconnect:
+      droppedForOverflow = true;
+      outbound.clear();
+      requestStop();
+      break;
   }
+}
 
-  const bool isHead = request.method() == http::verb::head;
-  http::response<http::string_body> response{http::status::ok,
-                                             request.version()};
-  response.set(http::field::content_type, "text/html");
-  if (request.method() != http::verb::get && !isHead) {
-    response.result(http::status::bad_request);
-    response.body() = "Unknown HTTP-method";
-    response.prepare_payload();
-  } else if (isHead) {
-    response.content_length(httpMessage.size());
-  } else {
-    response.body() = httpMessage;
-    response.prepare_payload();
-  }
 
-  co_await http::async_write(socket, response, as_tuple(use_awaitable));
+void
+Channel::publishQueueDepth() noexcept {
+  queuedMessages.store(outbound.size(), std::memory_order_relaxed);
+  queuedBytes.store(outbound.bytes(), std::memory_order_relaxed);
 }
 
 
 void
-ServerImpl::startChannel(asio::ip::tcp::socket socket,
-                         http::request<http::string_body> request) {
-  // A queued httpSession read-success can still resume and reach here after
-  // ~ServerImpl has begun tearing down. Once stopping, no fresh untracked
-  // work may be spawned, so drop the socket instead of starting a Channel.
-  if (stopping) {
-    return;
+Channel::requestStop() {
+  shard.cancelTask(task);
+}
+
+
+Shard::Tick
+Channel::checkIdle(Shard::Tick now) {
+  const auto& idle = shard.getIdleLimits();
+  const uint64_t bytesRead = websocket.next_layer().bytesRead();
+  if (bytesRead != lastBytesRead) {
+    lastBytesRead = bytesRead;
+    lastHeard = now;
+    pingSent = false;
   }
 
-  const Connection connection{nextConnectionId++};
-  auto channel = std::make_shared<Channel>(std::move(socket), connection, *this);
-  auto signal = spawnTracked(
-    // The factory lambda keeps the shared_ptr alive for the coroutine's
-    // whole lifetime; co_spawn guarantees the captures outlive the frame.
-    [channel, request = std::move(request)]() mutable -> awaitable<void> {
-      return channel->run(channel, std::move(request));
-    },
-    [this, connection] { channelDone(connection); });
-  channel->setStopSignal(std::move(signal));
+  const Shard::Tick silent = now - lastHeard;
+  if (silent >= idle.timeout) {
+    requestStop();
+    return 0;
+  }
+  if (idle.ping != 0 && silent >= idle.ping && !pingSent) {
+    // The writer sends it, since it owns the outgoing side of the stream.
+    pingSent = true;
+    pingDue = true;
+    wakeTimer.cancel_one();
+  }
+  return idle.checkEvery;
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
-// Accept Loop
+// Shard implementation
 /////////////////////////////////////////////////////////////////////////////
 
 
-// GCC's -Wmaybe-uninitialized fires on the anonymous as_tuple() result
-// carried in the coroutine's frame. The backoff wait below discards its
-// error_code, so nothing ever reads the temporary it warns about. The
-// diagnostic only appears under optimization, so it is invisible to Debug
-// builds. Maybe investigate more later.
-#if defined(__GNUC__) && !defined(__clang__)
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
-#endif
+namespace {
 
-awaitable<void>
-ServerImpl::acceptLoop() {
-  asio::steady_timer backoff{ioContext};
-  while (acceptor.is_open()) {
-    auto [error, socket] =
-      co_await acceptor.async_accept(as_tuple(use_awaitable));
-    if (error == asio::error::operation_aborted) {
-      co_return;
-    }
-    if (error) {
-      reportError("Accept error");
-      // Back off instead of spinning on persistent errors.
-      backoff.expires_after(100ms);
-      co_await backoff.async_wait(as_tuple(use_awaitable));
-      continue;
-    }
-    spawnTracked(httpSession(std::move(socket)), [] { });
+
+Shard::IdleLimits
+makeIdleLimits(const TimeoutOptions& timeouts) {
+  Shard::IdleLimits limits;
+  if (timeouts.idle <= 0ms) {
+    return limits;
   }
+  const std::chrono::nanoseconds idle = timeouts.idle;
+  limits.tick = std::clamp(idle / 8, MIN_IDLE_TICK, MAX_IDLE_TICK);
+  limits.timeout = static_cast<Shard::Tick>((idle + limits.tick - 1ns)
+                                            / limits.tick);
+  limits.ping =
+    timeouts.keepAlivePings ? std::max<Shard::Tick>(limits.timeout / 2, 1) : 0;
+  limits.checkEvery = std::max<Shard::Tick>(limits.timeout / 4, 1);
+  return limits;
 }
 
-#if defined(__GNUC__) && !defined(__clang__)
-#pragma GCC diagnostic pop
-#endif
 
+}
 
-/////////////////////////////////////////////////////////////////////////////
-// Hidden Server implementation
-/////////////////////////////////////////////////////////////////////////////
 
+Shard::Shard(ServerImpl& serverImpl, size_t index, bool threaded)
+  : serverImpl{serverImpl},
+    index{index},
+    threaded{threaded},
+    idleLimits{makeIdleLimits(serverImpl.options.timeouts)}
+    { }
 
-ServerImpl::ServerImpl(Server& server,
-                       unsigned short port,
-                       std::string httpMessage)
-  : server{server},
-    acceptor{ioContext, asio::ip::tcp::endpoint{asio::ip::tcp::v4(), port}},
-    httpMessage{std::move(httpMessage)} {
-  spawnTracked(acceptLoop(), [] { });
+
+template <typename Task, typename OnDone>
+Shard::TaskId
+Shard::spawnTracked(Task&& task, OnDone onDone) {
+  std::unique_ptr<asio::cancellation_signal> signal;
+  if (spareSignals.empty()) {
+    signal = std::make_unique<asio::cancellation_signal>();
+  } else {
+    signal = std::move(spareSignals.back());
+    spareSignals.pop_back();
+  }
+  auto& slot = *signal;
+  const TaskId id = activeTasks.insert(std::move(signal));
+  asio::co_spawn(ioContext, std::forward<Task>(task),
+    asio::bind_cancellation_slot(slot.slot(),
+      [this, id, onDone = std::move(onDone)](std::exception_ptr error) {
+        if (error) {
+          serverImpl.reportException("Server task", error);
+        }
+        if (auto* finished = activeTasks.find(id)) {
+          if (spareSignals.size() < MAX_SPARE_SIGNALS) {
+            spareSignals.push_back(std::move(*finished));
+          }
+          activeTasks.erase(id);
+        }
+        onDone();
+      }));
+  return id;
 }
 
 
-ServerImpl::~ServerImpl() {
-  stopping = true;
+awaitable<void>
+Shard::sweepIdle() {
+  asio::steady_timer timer{ioContext};
+  while (true) {
+    // Ticks follow the timer rather than the clock. An inline shard that
+    // update() has not run for a while has not read from its peers either,
+    // so it must not count that time as silence.
+    timer.expires_after(idleLimits.tick);
+    auto [error] = co_await timer.async_wait(as_tuple(use_awaitable));
+    if (error) {
+      co_return;
+    }
+    idleWheel.advance([this](IdleKey key) {
+      if (auto* channel = idleChannels.find(key)) {
+        if (const Tick next = (*channel)->checkIdle(idleWheel.now())) {
+          idleWheel.schedule(key, next);
+        }
+      }
+    });
+  }
+}
 
-  boost::system::error_code ignored;
-  acceptor.close(ignored);
 
-  for (auto& [id, signal] : activeTasks) {
-    signal->emit(asio::cancellation_type::terminal);
+void
+Shard::cancelTask(TaskId task) {
+  if (auto* signal = activeTasks.find(task)) {
+    (*signal)->emit(asio::cancellation_type::terminal);
   }
+}
 
-  // Drive the context until every tracked coroutine has completed, so that
-  // every frame and owned buffer is destroyed.
+
+void
+Shard::deliver(ShardEvent event) {
+  if (!threaded) {
+    serverImpl.applyEvent(event);
+    return;
+  }
+  bool wasEmpty = false;
+  {
+    std::lock_guard lock{eventMutex};
+    wasEmpty = events.empty();
+    events.push_back(std::move(event));
+  }
+  // Later events in the same batch ride along with the first one's wakeup.
+  if (wasEmpty) {
+    serverImpl.notifyEvents();
+  }
+}
+
+
+void
+Shard::takeEvents(std::vector<ShardEvent>& batch) {
+  // Swapping keeps the capacity of both vectors in circulation, so steady
+  // state traffic does not allocate here.
+  batch.clear();
+  std::lock_guard lock{eventMutex};
+  std::swap(batch, events);
+}
+
+
+void
+Shard::startThread() {
+  assert(threaded && "only threaded shards own a thread");
+  workGuard.emplace(ioContext.get_executor());
+  thread = std::thread{[this] {
+    while (true) {
+      try {
+        ioContext.run();
+        return;
+      } catch (...) {
+        serverImpl.reportException("I/O thread", std::current_exception());
+      }
+    }
+  }};
+}
+
+
+void
+Shard::stopThread() {
+  if (!thread.joinable()) {
+    return;
+  }
+  // Cancellation must be emitted from the shard's own thread. Once every
+  // tracked task has finished and the guard is gone, run() returns.
+  asio::post(ioContext, [this] { cancelTasks(); });
+  workGuard.reset();
+  thread.join();
+}
+
+
+void
+Shard::drain() {
+  cancelTasks();
+
+  // Drive the context until every tracked coroutine has completed, so that
+  // every frame and owned buffer is destroyed.
   while (!activeTasks.empty()) {
     ioContext.restart();
     if (ioContext.run() == 0 && !activeTasks.empty()) {
@@ -394,34 +1181,886 @@ ServerImpl::~ServerImpl() {
     }
   }
 
+  // Handlers posted after the last task finished (e.g. sends or stray
+  // connections handed over from another shard) still own resources.
+  ioContext.restart();
+  ioContext.poll();
+}
+
+
+void
+Shard::cancelTasks() {
+  for (auto& signal : activeTasks.getValues()) {
+    signal->emit(asio::cancellation_type::terminal);
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Basic HTTP Request Handling
+/////////////////////////////////////////////////////////////////////////////
+
+
+awaitable<void>
+ServerImpl::httpSession(Shard& shard,
+                        StreamSocket socket,
+                        AdmissionTicket ticket) {
+  TransportStream stream{std::move(socket)};
+  if (!co_await handshakeTls(shard, stream)) {
+    co_return;
+  }
+
+  // One buffer serves the whole session, so bytes of a pipelined request
+  // that arrived along with the previous one are parsed next.
+  beast::flat_buffer buffer;
+
+  for (;;) {
+    http::request<http::string_body> request;
+    auto [readError, readBytes] = co_await http::async_read(
+      stream, buffer, request,
+      asio::cancel_after(options.httpIdleTimeout, as_tuple(use_awaitable)));
+    (void)readBytes;
+    if (readError) {
+      co_return;
+    }
+
+    if (websock::is_upgrade(request)) {
+      startChannel(shard, std::move(stream), std::move(ticket),
+                   std::move(request));
+      co_return;
+    }
+
+    const bool completed = co_await respond(stream, request);
+    if (!completed || !request.keep_alive()) {
+      break;
+    }
+  }
+
+  // Responses carry their length, so a TLS close_notify adds nothing that
+  // would justify waiting on the peer.
+  boost::system::error_code ignored;
+  stream.next_layer().shutdown(StreamSocket::shutdown_send, ignored);
+}
+
+
+awaitable<bool>
+ServerImpl::handshakeTls(Shard& shard, TransportStream& stream) {
+#ifdef NETWORKING_ENABLE_TLS
+  if (!tlsContext) {
+    co_return true;
+  }
+  stream.startTls(*tlsContext);
+  const auto timeout = options.timeouts.handshake;
+  auto& tls = stream.tlsStream();
+  auto [error] = timeout > 0ms
+    ? co_await tls.async_handshake(asio::ssl::stream_base::server,
+        asio::cancel_after(timeout, as_tuple(use_awaitable)))
+    : co_await tls.async_handshake(asio::ssl::stream_base::server,
+                                   as_tuple(use_awaitable));
+  if (error) {
+    shard.tlsHandshakeErrors.add(1);
+    co_return false;
+  }
+  shard.tlsHandshakes.add(1);
+  if (SSL_session_reused(tls.native_handle())) {
+    shard.tlsResumedHandshakes.add(1);
+  }
+  co_return true;
+#else
+  (void)shard;
+  (void)stream;
+  co_return true;
+#endif
+}
+
+
+namespace {
+
+
+using BodySpan = http::span_body<const char>::value_type;
+
+
+// The httpMessage answers for the root and for any path ending in index.html.
+bool
+isIndexTarget(std::string_view target) {
+  target = target.substr(0, target.find_first_of("?#"));
+  return target == "/" || target.ends_with("index.html");
+}
+
+
+template <typename Body>
+void
+setFileHeaders(http::response<Body>& response, const StaticFiles::File& file) {
+  response.set(http::field::content_type, file.contentType);
+  response.set(http::field::etag, file.etag);
+  // Browsers may keep the file but must revalidate it, which the ETag makes
+  // cheap.
+  response.set(http::field::cache_control, "no-cache");
+}
+
+
+http::response<http::string_body>
+makeErrorResponse(const http::request<http::string_body>& request,
+                  http::status status,
+                  std::string body) {
+  http::response<http::string_body> response{status, request.version()};
+  response.set(http::field::content_type, "text/plain");
+  response.body() = std::move(body);
+  response.prepare_payload();
+  return response;
+}
+
+
+// True if an Accept-Encoding header value admits gzip. A malformed header
+// admits nothing.
+bool
+acceptsGzip(beast::string_view acceptEncoding) {
+  for (const auto& coding : http::ext_list{acceptEncoding}) {
+    if (!beast::iequals(coding.first, "gzip")) {
+      continue;
+    }
+    for (const auto& param : coding.second) {
+      if (beast::iequals(param.first, "q")) {
+        return param.second.find_first_not_of("0.")
+            != beast::string_view::npos;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+
+// Writes a response that keeps the connection alive exactly when the request
+// asked for it. Returns false if the response could not be written.
+template <typename Body>
+awaitable<bool>
+writeResponse(TransportStream& stream,
+              const http::request<http::string_body>& request,
+              http::response<Body>& response) {
+  response.keep_alive(request.keep_alive());
+  auto [error, bytes] =
+    co_await http::async_write(stream, response, as_tuple(use_awaitable));
+  (void)bytes;
+  co_return !error;
+}
+
+
+#if defined(__linux__)
+
+// Copies a file to the socket with sendfile(2), so its contents go from the
+// page cache to the socket without passing through user space. A full send
+// buffer suspends the coroutine until the socket drains rather than
+// blocking the shard. Returns false unless the whole file was sent.
+awaitable<bool>
+sendFileContents(StreamSocket& socket, int fd, uint64_t size) {
+  boost::system::error_code error;
+  socket.native_non_blocking(true, error);
+  if (error) {
+    co_return false;
+  }
+
+  off_t offset = 0;
+  while (static_cast<uint64_t>(offset) < size) {
+    const auto chunk = static_cast<size_t>(
+      std::min<uint64_t>(size - static_cast<uint64_t>(offset),
+                         MAX_SENDFILE_CHUNK));
+    const ssize_t sent = ::sendfile(socket.native_handle(), fd, &offset, chunk);
+    if (sent > 0) {
+      co_await asio::post(socket.get_executor(), use_awaitable);
+    } else if (sent == 0) {
+      // The file was truncated underneath us.
+      co_return false;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      auto [waitError] = co_await socket.async_wait(
+        asio::socket_base::wait_write, as_tuple(use_awaitable));
+      if (waitError) {
+        co_return false;
+      }
+    } else if (errno != EINTR) {
+      co_return false;
+    }
+  }
+  co_return true;
+}
+
+#endif
+
+
+}
+
+
+awaitable<bool>
+ServerImpl::respond(TransportStream& stream,
+                    const http::request<http::string_body>& request) {
+  const bool isHead = request.method() == http::verb::head;
+  if (request.method() != http::verb::get && !isHead) {
+    auto response = makeErrorResponse(request, http::status::bad_request,
+                                      "Unknown HTTP-method");
+    co_return co_await writeResponse(stream, request, response);
+  }
+
+  if (staticFiles) {
+    if (auto file =
+          co_await findStaticFile(std::string{request.target()})) {
+      co_return co_await sendStaticFile(stream, request, *file);
+    }
+    if (!isIndexTarget(request.target())) {
+      auto response =
+        makeErrorResponse(request, http::status::not_found, "Not Found");
+      co_return co_await writeResponse(stream, request, response);
+    }
+  }
+
+  if (request.version() == 11) {
+    const auto& prebuilt = indexResponses.select(
+      acceptsGzip(request[http::field::accept_encoding]), request.keep_alive());
+    const size_t size = isHead ? prebuilt.headerSize : prebuilt.bytes.size();
+    auto [error, written] = co_await asio::async_write(
+      stream, asio::buffer(prebuilt.bytes.data(), size),
+      as_tuple(use_awaitable));
+    (void)written;
+    co_return !error;
+  }
+
+  // Other HTTP versions are rare enough to be serialized on demand. The body
+  // refers to httpMessage in place instead of copying it.
+  http::response<http::span_body<const char>> response{http::status::ok,
+                                                        request.version()};
+  response.set(http::field::content_type, "text/html");
+  response.content_length(httpMessage.size());
+  if (!isHead) {
+    response.body() = BodySpan{httpMessage.data(), httpMessage.size()};
+  }
+  co_return co_await writeResponse(stream, request, response);
+}
+
+
+awaitable<std::shared_ptr<const StaticFiles::File>>
+ServerImpl::findStaticFile(std::string target) {
+  // Looking a file up stats it and may read it into the cache, which would
+  // stall every connection of the shard on a slow disk. The lookup runs on
+  // the file workers and the result comes back to the shard.
+  co_return co_await asio::co_spawn(
+    *fileWorkers,
+    [this, target = std::move(target)]()
+        -> awaitable<std::shared_ptr<const StaticFiles::File>> {
+      co_return staticFiles->find(target);
+    },
+    use_awaitable);
+}
+
+
+awaitable<bool>
+ServerImpl::sendStaticFile(TransportStream& stream,
+                           const http::request<http::string_body>& request,
+                           const StaticFiles::File& file) {
+  const bool isHead = request.method() == http::verb::head;
+  if (auto match = request[http::field::if_none_match];
+      !match.empty() && StaticFiles::matchesETag(match, file.etag)) {
+    http::response<http::empty_body> response{http::status::not_modified,
+                                               request.version()};
+    response.set(http::field::etag, file.etag);
+    response.set(http::field::cache_control, "no-cache");
+    co_return co_await writeResponse(stream, request, response);
+  }
+
+  if (file.contents) {
+    http::response<http::span_body<const char>> response{http::status::ok,
+                                                          request.version()};
+    setFileHeaders(response, file);
+    response.content_length(file.contents->size());
+    if (!isHead) {
+      response.body() = BodySpan{file.contents->data(), file.contents->size()};
+    }
+    co_return co_await writeResponse(stream, request, response);
+  }
+
+  http::file_body::value_type body;
+  beast::error_code openError;
+  body.open(file.path.string().c_str(), beast::file_mode::scan, openError);
+  if (openError) {
+    auto response =
+      makeErrorResponse(request, http::status::not_found, "Not Found");
+    co_return co_await writeResponse(stream, request, response);
+  }
+
+  const uint64_t size = body.size();
+  http::response<http::empty_body> header{http::status::ok, request.version()};
+  setFileHeaders(header, file);
+  header.content_length(size);
+  if (isHead) {
+    co_return co_await writeResponse(stream, request, header);
+  }
+
+#if defined(__linux__)
+  // The kernel cannot encrypt for us, so TLS connections take the file
+  // through user space like other platforms do.
+  if (!stream.isTls()) {
+    header.keep_alive(request.keep_alive());
+    http::response_serializer<http::empty_body> serializer{header};
+    auto [headerError, headerBytes] = co_await http::async_write_header(
+      stream, serializer, as_tuple(use_awaitable));
+    (void)headerBytes;
+    if (headerError) {
+      co_return false;
+    }
+    const int fd = body.file().native_handle();
+    co_return co_await sendFileContents(stream.next_layer(), fd, size);
+  }
+#endif
+  http::response<http::file_body> response{std::move(header.base()),
+                                           std::move(body)};
+  co_return co_await writeResponse(stream, request, response);
+}
+
+
+void
+ServerImpl::startChannel(Shard& shard,
+                         TransportStream stream,
+                         AdmissionTicket ticket,
+                         http::request<http::string_body> request) {
+  // A queued httpSession read-success can still resume and reach here after
+  // ~ServerImpl has begun tearing down. Once stopping, no fresh untracked
+  // work may be spawned, so drop the socket instead of starting a Channel.
+  if (stopping) {
+    return;
+  }
+
+  // The Channel and its control block share one block from the shard's pool.
+  auto channel =
+    std::allocate_shared<Channel>(RecyclingAllocator<Channel>{shard.channelPool},
+                                  std::move(stream), std::move(ticket),
+                                  shard);
+  auto task = shard.spawnTracked(
+    // The factory lambda keeps the shared_ptr alive for the coroutine's
+    // whole lifetime; co_spawn guarantees the captures outlive the frame.
+    [channel, request = std::move(request)]() mutable -> awaitable<void> {
+      return channel->run(channel, std::move(request));
+    },
+    [&shard, channel] {
+      channel->finish();
+      shard.deliver({ShardEvent::Kind::Disconnected, channel.get(), channel, {}});
+    });
+  channel->setTask(task);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Accept Loop
+/////////////////////////////////////////////////////////////////////////////
+
+
+// GCC's -Wmaybe-uninitialized fires on the anonymous as_tuple() result
+// carried in the coroutine's frame. The backoff wait below discards its
+// error_code, so nothing ever reads the temporary it warns about. The
+// diagnostic only appears under optimization, so it is invisible to Debug
+// builds. Maybe investigate more later.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+awaitable<void>
+ServerImpl::acceptLoop(StreamAcceptor& acceptor) {
+  Shard& acceptShard = *shards.front();
+  asio::steady_timer backoff{acceptShard.ioContext};
+  while (acceptor.is_open()) {
+    // Accepted sockets are bound straight to the context of the shard that
+    // will serve them, spreading connections round robin.
+    Shard& target = *shards[nextShard];
+    nextShard = (nextShard + 1) % shards.size();
+
+    auto [error, accepted] =
+      co_await acceptor.async_accept(target.ioContext, as_tuple(use_awaitable));
+    if (error == asio::error::operation_aborted) {
+      co_return;
+    }
+    if (error) {
+      acceptShard.acceptErrors.add(1);
+      reportError("Accept error: " + error.message());
+      // Back off instead of spinning on persistent errors.
+      backoff.expires_after(100ms);
+      co_await backoff.async_wait(as_tuple(use_awaitable));
+      continue;
+    }
+
+    StreamSocket socket{std::move(accepted)};
+    const size_t maxConnections = options.admission.maxConnections;
+    if (maxConnections != 0
+        && openConnections.load(std::memory_order_relaxed) >= maxConnections) {
+      acceptShard.rejectedOverCapacity.add(1);
+      rejectConnection(socket);
+      continue;
+    }
+    if (!acceptRate.tryTake()) {
+      acceptShard.rejectedOverRate.add(1);
+      rejectConnection(socket);
+      continue;
+    }
+
+    acceptShard.accepted.add(1);
+    AdmissionTicket ticket{openConnections};
+    if (&target == &acceptShard) {
+      target.spawnTracked(
+        httpSession(target, std::move(socket), std::move(ticket)), [] { });
+      continue;
+    }
+    asio::post(target.ioContext,
+      [this, &target, socket = std::move(socket),
+       ticket = std::move(ticket)]() mutable {
+        // The shard may already have been told to stop; the socket is
+        // simply dropped then.
+        if (!stopping) {
+          target.spawnTracked(
+            httpSession(target, std::move(socket), std::move(ticket)),
+            [] { });
+        }
+      });
+  }
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+
+void
+ServerImpl::rejectConnection(StreamSocket& socket) {
+  // A rejected peer gets a single non-blocking write and nothing more: the
+  // point is to shed load, so nothing may wait on it. A peer that is not
+  // ready for the response just sees the close.
+  static constexpr std::string_view RESPONSE =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "Retry-After: 1\r\n"
+    "\r\n";
+  boost::system::error_code ignored;
+  socket.non_blocking(true, ignored);
+  socket.write_some(asio::buffer(RESPONSE), ignored);
+  socket.shutdown(StreamSocket::shutdown_both, ignored);
+  socket.close(ignored);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Hidden Server implementation
+/////////////////////////////////////////////////////////////////////////////
+
+
+// Throws for settings that cannot work, rather than letting every connection
+// fail on them later.
+static void
+checkServerOptions(const ServerOptions& options) {
+  checkCompressionOptions(options.compression);
+  if (options.httpIdleTimeout <= 0ms) {
+    throw boost::system::system_error{
+      make_error_code(boost::system::errc::invalid_argument),
+      "httpIdleTimeout"};
+  }
+  if (options.receive.fragmentBytes == 0) {
+    throw boost::system::system_error{
+      make_error_code(boost::system::errc::invalid_argument),
+      "receive.fragmentBytes"};
+  }
+}
+
+
+static int
+listenBacklog(const ServerOptions& options) {
+  const int backlog = options.admission.listenBacklog;
+  return backlog > 0 ? backlog : asio::socket_base::max_listen_connections;
+}
+
+
+#ifdef SO_REUSEPORT
+/**
+ *  SO_REUSEPORT as a SettableSocketOption, which asio does not provide.
+ */
+class ReusePort {
+public:
+  explicit ReusePort(bool enabled) noexcept
+    : value{enabled ? 1 : 0}
+      { }
+
+  template <typename Protocol>
+  int level(const Protocol&) const noexcept { return SOL_SOCKET; }
+
+  template <typename Protocol>
+  int name(const Protocol&) const noexcept { return SO_REUSEPORT; }
+
+  template <typename Protocol>
+  const int* data(const Protocol&) const noexcept { return &value; }
+
+  template <typename Protocol>
+  size_t size(const Protocol&) const noexcept { return sizeof(value); }
+
+private:
+  int value;
+};
+#endif
+
+
+static asio::ip::tcp::acceptor
+openAcceptor(asio::io_context& context,
+             unsigned short port,
+             const ServerOptions& options) {
+  const asio::ip::tcp::endpoint endpoint{
+    options.dualStack ? asio::ip::tcp::v6() : asio::ip::tcp::v4(), port};
+  asio::ip::tcp::acceptor acceptor{context, endpoint.protocol()};
+  acceptor.set_option(asio::socket_base::reuse_address{true});
+  if (options.dualStack) {
+    acceptor.set_option(asio::ip::v6_only{false});
+  }
+  if (options.reusePort) {
+#ifdef SO_REUSEPORT
+    acceptor.set_option(ReusePort{true});
+#else
+    throw boost::system::system_error{asio::error::operation_not_supported,
+                                      "SO_REUSEPORT"};
+#endif
+  }
+  acceptor.bind(endpoint);
+  acceptor.listen(listenBacklog(options));
+  return acceptor;
+}
+
+
+static StreamAcceptor
+openUnixAcceptor(asio::io_context& context, const ServerOptions& options) {
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+  // Binding fails on an existing file. Only a socket that refuses
+  // connections is taken to be stale, so that neither a mistyped path nor a
+  // live server's socket gets deleted. The probe is a raw non-blocking
+  // connect, because asio's would wait out a full backlog.
+  const asio::local::stream_protocol::endpoint endpoint{
+    options.unixSocket.string()};
+  std::error_code ignored;
+  if (std::filesystem::is_socket(options.unixSocket, ignored)) {
+    asio::local::stream_protocol::socket probe{context, endpoint.protocol()};
+    probe.native_non_blocking(true);
+    if (::connect(probe.native_handle(), endpoint.data(),
+                  static_cast<socklen_t>(endpoint.size())) != 0
+        && errno == ECONNREFUSED) {
+      std::filesystem::remove(options.unixSocket, ignored);
+    }
+  }
+  asio::local::stream_protocol::acceptor acceptor{context,
+                                                  endpoint.protocol()};
+  acceptor.bind(endpoint);
+  acceptor.listen(listenBacklog(options));
+  return StreamAcceptor{std::move(acceptor)};
+#else
+  (void)context;
+  (void)options;
+  throw boost::system::system_error{asio::error::operation_not_supported,
+                                    "Unix domain sockets"};
+#endif
+}
+
+
+#ifdef NETWORKING_ENABLE_TLS
+
+static asio::ssl::context
+makeTlsContext(const TlsServerOptions& tls) {
+  asio::ssl::context context{asio::ssl::context::tls_server};
+  context.set_options(asio::ssl::context::default_workarounds
+                      | asio::ssl::context::no_sslv2
+                      | asio::ssl::context::no_sslv3
+                      | asio::ssl::context::no_tlsv1
+                      | asio::ssl::context::no_tlsv1_1);
+  context.use_certificate_chain_file(tls.certificateChainFile.string());
+  context.use_private_key_file(tls.privateKeyFile.string(),
+                               asio::ssl::context::pem);
+
+  SSL_CTX* native = context.native_handle();
+  if (tls.sessionResumption) {
+    // OpenSSL issues tickets by default. The cache serves clients that
+    // resume by session ID instead.
+    static constexpr unsigned char SESSION_ID_CONTEXT[] = "networking";
+    SSL_CTX_set_session_id_context(native, SESSION_ID_CONTEXT,
+                                   sizeof(SESSION_ID_CONTEXT) - 1);
+    SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(native,
+                                static_cast<long>(tls.sessionCacheSize));
+  } else {
+    SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_options(native, SSL_OP_NO_TICKET);
+    SSL_CTX_set_num_tickets(native, 0);
+  }
+  return context;
+}
+
+#endif
+
+
+static std::vector<std::unique_ptr<Shard>>
+buildShards(ServerImpl& serverImpl, unsigned ioThreads) {
+  std::vector<std::unique_ptr<Shard>> shards;
+  const bool threaded = ioThreads > 0;
+  const size_t count = threaded ? ioThreads : 1;
+  shards.reserve(count);
+  for (size_t index = 0; index < count; ++index) {
+    shards.push_back(std::make_unique<Shard>(serverImpl, index, threaded));
+  }
+  return shards;
+}
+
+
+ServerImpl::ServerImpl(Server& server,
+                       unsigned short port,
+                       std::string httpMessage,
+                       ServerOptions options)
+  : server{server},
+    options{std::move(options)},
+    shards{buildShards(*this, this->options.ioThreads)},
+    httpMessage{std::move(httpMessage)},
+    indexResponses{this->httpMessage},
+    acceptRate{this->options.admission.acceptsPerSecond,
+               static_cast<double>(this->options.admission.acceptBurst)},
+    receiveBuffers{this->options.receiveBufferPoolSize, MAX_POOLED_BUFFER_BYTES},
+    pendingSends(shards.size()) {
+  checkServerOptions(this->options);
+
+  auto& acceptContext = shards.front()->ioContext;
+  auto tcpAcceptor = openAcceptor(acceptContext, port, this->options);
+  boundPort = tcpAcceptor.local_endpoint().port();
+  acceptors.emplace_back(std::move(tcpAcceptor));
+  if (!this->options.unixSocket.empty()) {
+    acceptors.push_back(openUnixAcceptor(acceptContext, this->options));
+    unixSocketFile = identifyFile(this->options.unixSocket);
+  }
+
+  if (this->options.tls.enabled) {
+#ifdef NETWORKING_ENABLE_TLS
+    tlsContext.emplace(makeTlsContext(this->options.tls));
+#else
+    throw boost::system::system_error{asio::error::operation_not_supported,
+                                      "TLS"};
+#endif
+  }
+
+  if (shards.front()->isThreaded()) {
+    wakeup.emplace();
+  }
+  if (const auto& files = this->options.staticFiles; !files.directory.empty()) {
+    staticFiles.emplace(files.directory, files.cacheBytes,
+                        files.maxCachedFileBytes);
+    fileWorkers.emplace(STATIC_FILE_THREADS);
+  }
+  for (auto& acceptor : acceptors) {
+    shards.front()->spawnTracked(acceptLoop(acceptor), [] { });
+  }
+  for (auto& shard : shards) {
+    if (shard->getIdleLimits().timeout != 0) {
+      shard->spawnTracked(shard->sweepIdle(), [] { });
+    }
+  }
+  for (auto& shard : shards) {
+    if (shard->isThreaded()) {
+      shard->startThread();
+    }
+  }
+}
+
+
+ServerImpl::~ServerImpl() {
+  stopping = true;
+
+  // Threaded shards wind down on their own threads first. Afterwards every
+  // shard is only touched from here.
+  for (auto& shard : shards) {
+    shard->stopThread();
+  }
+
+  boost::system::error_code ignored;
+  for (auto& acceptor : acceptors) {
+    acceptor.close(ignored);
+  }
+  // Another process may have replaced the file since; that one stays.
+  if (unixSocketFile && identifyFile(options.unixSocket) == unixSocketFile) {
+    std::error_code removeError;
+    std::filesystem::remove(options.unixSocket, removeError);
+  }
+
+  for (auto& shard : shards) {
+    shard->drain();
+  }
+
   channels.clear();
 }
 
 
+void
+ServerImpl::applyEvent(ShardEvent& event) {
+  switch (event.kind) {
+    case ShardEvent::Kind::Connected:
+      registerChannel(std::move(event.owner));
+      break;
+    case ShardEvent::Kind::Received:
+      incoming.push_back({event.channel->getConnection(),
+                          std::move(event.text), event.type,
+                          event.endOfMessage});
+      break;
+    case ShardEvent::Kind::Overflowed:
+      if (event.channel->getShard().isThreaded()) {
+        reportOverflow(event.channel->getConnection());
+      } else {
+        overflowed.push_back(event.channel->getConnection());
+      }
+      break;
+    case ShardEvent::Kind::Disconnected:
+      channelDone(*event.channel);
+      break;
+  }
+}
+
+
+void
+ServerImpl::reportOverflow(Connection connection) {
+  // Not reported once the application has disconnected the channel.
+  if (options.onOverflow && channels.contains(connection.id)) {
+    options.onOverflow(connection, options.outboundLimits.policy);
+  }
+}
+
+
+void
+ServerImpl::notifyEvents() {
+  {
+    std::lock_guard lock{wakeMutex};
+    eventsPending = true;
+  }
+  wakeCondition.notify_one();
+  wakeup->notify();
+}
+
+
+void
+ServerImpl::waitForEvents(std::chrono::nanoseconds maxWait) {
+  std::unique_lock lock{wakeMutex};
+  if (maxWait > 0ns) {
+    wakeCondition.wait_for(lock, maxWait, [this] { return eventsPending; });
+  }
+  // Cleared before the events are taken, so that any event queued from here
+  // on raises the flag again for the next wait.
+  eventsPending = false;
+  wakeup->clear();
+}
+
+
 void
 ServerImpl::registerChannel(std::shared_ptr<Channel> channel) {
-  const auto connection = channel->getConnection();
-  channels[connection] = std::move(channel);
+  Channel& registered = *channel;
+  const Connection connection{channels.insert(std::move(channel))};
+  registered.setConnection(connection);
   server.connectionHandler->handleConnect(connection);
 }
 
 
 void
-ServerImpl::channelDone(Connection connection) {
+ServerImpl::channelDone(Channel& channel) {
   if (stopping) {
     return;
   }
-  // erase() returning zero means the connection was never registered or was
+  // erase() failing means the connection was never registered or was
   // already removed by an explicit disconnect.
-  if (channels.erase(connection) > 0) {
+  const auto connection = channel.getConnection();
+  if (channels.erase(connection.id)) {
+    ++closedConnections;
     server.connectionHandler->handleDisconnect(connection);
   }
 }
 
 
 void
-ServerImpl::reportError(std::string_view /*message*/) {
-  // Swallow errors....
+ServerImpl::enqueue(const std::shared_ptr<Channel>& channel, Outgoing message) {
+  Shard& shard = channel->getShard();
+  if (!shard.isThreaded()) {
+    channel->send(std::move(message));
+    return;
+  }
+  pendingSends[shard.getIndex()].emplace_back(channel, std::move(message));
+}
+
+
+void
+ServerImpl::flushSends() {
+  for (auto& shard : shards) {
+    auto& batch = pendingSends[shard->getIndex()];
+    if (batch.empty()) {
+      continue;
+    }
+    asio::post(shard->ioContext, [batch = std::move(batch)]() mutable {
+      for (auto& [channel, message] : batch) {
+        channel->send(std::move(message));
+      }
+    });
+    batch.clear();
+  }
+}
+
+
+void
+ServerImpl::markDelivered(const std::vector<Message>& messages) {
+  if (options.receive.maxUndeliveredBytes == 0) {
+    return;
+  }
+  for (const auto& message : messages) {
+    auto* channel = channels.find(message.connection.id);
+    if (channel == nullptr || !(*channel)->delivered(message.text.size())) {
+      continue;
+    }
+    Shard& shard = (*channel)->getShard();
+    if (!shard.isThreaded()) {
+      (*channel)->resumeReading();
+    } else {
+      asio::post(shard.ioContext,
+                 [channel = *channel] { channel->resumeReading(); });
+    }
+  }
+}
+
+
+void
+ServerImpl::reportError(std::string message) {
+  if (!options.onError) {
+    return;
+  }
+  std::lock_guard lock{errorMutex};
+  if (pendingErrors.size() < MAX_PENDING_ERRORS) {
+    pendingErrors.push_back(std::move(message));
+  }
+}
+
+
+void
+ServerImpl::reportException(std::string_view where, std::exception_ptr error) {
+  handlerErrors.fetch_add(1, std::memory_order_relaxed);
+  std::string message{where};
+  try {
+    std::rethrow_exception(error);
+  } catch (const std::exception& exception) {
+    message += ": ";
+    message += exception.what();
+  } catch (...) {
+    message += ": unknown exception";
+  }
+  reportError(std::move(message));
+}
+
+
+void
+ServerImpl::deliverErrors() {
+  {
+    std::lock_guard lock{errorMutex};
+    std::swap(errorBatch, pendingErrors);
+  }
+  for (const auto& message : errorBatch) {
+    options.onError(message);
+  }
+  errorBatch.clear();
 }
 
 
@@ -443,58 +2082,260 @@ ServerImplDeleter::operator()(ServerImpl* serverImpl) {
 
 unsigned short
 Server::getPort() const {
-  return impl->acceptor.local_endpoint().port();
+  return impl->boundPort;
 }
 
 
 void
 Server::update() {
-  impl->ioContext.poll();
+  update(std::chrono::nanoseconds::zero());
+}
+
+
+void
+Server::update(std::chrono::nanoseconds maxWait) {
+  // Messages still waiting to be received mean there is no reason to block.
+  if (!impl->incoming.empty()) {
+    maxWait = std::chrono::nanoseconds::zero();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  uint64_t handlers = 0;
+  if (!impl->shards.front()->isThreaded()) {
+    // Report overflows from earlier sends first, so that they precede the
+    // disconnects they may cause. The callback may send again, which can
+    // overflow again, so it works through a batch of its own.
+    std::swap(impl->overflowBatch, impl->overflowed);
+    const bool reported = !impl->overflowBatch.empty();
+    for (auto connection : impl->overflowBatch) {
+      impl->reportOverflow(connection);
+    }
+    impl->overflowBatch.clear();
+
+    auto& ioContext = impl->shards.front()->ioContext;
+    if (maxWait > 0ns && !reported) {
+      handlers += ioContext.run_one_for(maxWait);
+      start = std::chrono::steady_clock::now();
+    }
+    handlers += ioContext.poll();
+  } else {
+    impl->waitForEvents(maxWait);
+    start = std::chrono::steady_clock::now();
+    for (auto& shard : impl->shards) {
+      shard->takeEvents(impl->eventBatch);
+      handlers += impl->eventBatch.size();
+      for (auto& event : impl->eventBatch) {
+        impl->applyEvent(event);
+      }
+    }
+    impl->eventBatch.clear();
+  }
+  impl->deliverErrors();
+
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  ++impl->updates;
+  impl->lastUpdateHandlers = handlers;
+  impl->totalUpdateHandlers += handlers;
+  impl->lastUpdateTime = elapsed;
+  impl->totalUpdateTime += elapsed;
 }
 
 
 std::deque<Message>
 Server::receive() {
-  std::deque<Message> oldIncoming;
-  std::swap(oldIncoming, impl->incoming);
-  return oldIncoming;
+  impl->markDelivered(impl->incoming);
+  std::deque<Message> received{std::make_move_iterator(impl->incoming.begin()),
+                               std::make_move_iterator(impl->incoming.end())};
+  impl->incoming.clear();
+  return received;
+}
+
+
+void
+Server::receiveInto(std::vector<Message>& messages) {
+  for (auto& message : messages) {
+    impl->receiveBuffers.release(std::move(message.text));
+  }
+  messages.clear();
+  std::swap(messages, impl->incoming);
+  impl->markDelivered(messages);
+}
+
+
+void
+Server::recycle(std::deque<Message>&& messages) {
+  for (auto& message : messages) {
+    impl->receiveBuffers.release(std::move(message.text));
+  }
+  messages.clear();
 }
 
 
 void
 Server::send(const std::deque<Message>& messages) {
   for (const auto& message : messages) {
-    auto found = impl->channels.find(message.connection);
-    if (impl->channels.end() != found) {
-      found->second->send(message.text);
+    if (auto* channel = impl->channels.find(message.connection.id)) {
+      impl->enqueue(*channel, Outgoing{nullptr, message.text, message.type,
+                                       message.priority});
+    }
+  }
+  impl->flushSends();
+}
+
+
+void
+Server::send(Connection connection, std::span<const std::byte> payload,
+             Priority priority) {
+  if (auto* channel = impl->channels.find(connection.id)) {
+    std::string bytes{reinterpret_cast<const char*>(payload.data()),
+                      payload.size()};
+    impl->enqueue(*channel,
+                  Outgoing{nullptr, std::move(bytes), MessageType::Binary,
+                           priority});
+    impl->flushSends();
+  }
+}
+
+
+void
+Server::sendLatest(Connection connection, uint64_t key, std::string payload,
+                   MessageType type, Priority priority) {
+  if (auto* channel = impl->channels.find(connection.id)) {
+    impl->enqueue(*channel,
+                  Outgoing{nullptr, std::move(payload), type, priority, key});
+    impl->flushSends();
+  }
+}
+
+
+void
+Server::broadcast(std::string payload,
+                  std::span<const Connection> connections,
+                  MessageType type,
+                  Priority priority) {
+  if (payload.empty()) {
+    return;
+  }
+  auto shared = std::make_shared<const std::string>(std::move(payload));
+  for (auto connection : connections) {
+    if (auto* channel = impl->channels.find(connection.id)) {
+      impl->enqueue(*channel, Outgoing{shared, {}, type, priority});
     }
   }
+  impl->flushSends();
+}
+
+
+void
+Server::broadcast(std::string payload, MessageType type, Priority priority) {
+  if (payload.empty()) {
+    return;
+  }
+  auto shared = std::make_shared<const std::string>(std::move(payload));
+  for (auto& channel : impl->channels.getValues()) {
+    impl->enqueue(channel, Outgoing{shared, {}, type, priority});
+  }
+  impl->flushSends();
 }
 
 
 void
 Server::disconnect(Connection connection) {
-  auto found = impl->channels.find(connection);
-  if (impl->channels.end() != found) {
+  if (auto* found = impl->channels.find(connection.id)) {
     // Pin the channel locally while cleaning up.
-    auto channel = std::move(found->second);
-    impl->channels.erase(found);
+    auto channel = std::move(*found);
+    impl->channels.erase(connection.id);
+    ++impl->closedConnections;
 
     connectionHandler->handleDisconnect(connection);
-    channel->requestStop();
+    channel->getShard().execute([channel] { channel->requestStop(); });
+  }
+}
+
+
+int
+Server::nativeHandle() const noexcept {
+  return impl->wakeup ? impl->wakeup->handle() : -1;
+}
+
+
+ServerStats
+Server::stats() const {
+  ServerStats stats;
+  for (const auto& shard : impl->shards) {
+    stats.acceptedConnections += shard->accepted.get();
+    stats.acceptErrors += shard->acceptErrors.get();
+    stats.rejectedOverCapacity += shard->rejectedOverCapacity.get();
+    stats.rejectedOverRate += shard->rejectedOverRate.get();
+    stats.tlsHandshakes += shard->tlsHandshakes.get();
+    stats.tlsResumedHandshakes += shard->tlsResumedHandshakes.get();
+    stats.tlsHandshakeErrors += shard->tlsHandshakeErrors.get();
+    stats.messagesIn += shard->traffic.messagesIn.get();
+    stats.bytesIn += shard->traffic.bytesIn.get();
+    stats.messagesOut += shard->traffic.messagesOut.get();
+    stats.bytesOut += shard->traffic.bytesOut.get();
+    stats.supersededMessages += shard->supersededMessages.get();
+  }
+  for (const auto& channel : impl->channels.getValues()) {
+    const auto depth = channel->getQueueDepth();
+    stats.queued.messages += depth.messages;
+    stats.queued.bytes += depth.bytes;
+  }
+  stats.activeConnections = impl->channels.size();
+  stats.handlerErrors =
+    impl->handlerErrors.load(std::memory_order_relaxed);
+  stats.closedConnections = impl->closedConnections;
+  stats.updates = impl->updates;
+  stats.lastUpdateHandlers = impl->lastUpdateHandlers;
+  stats.lastUpdateTime = impl->lastUpdateTime;
+  stats.totalUpdateHandlers = impl->totalUpdateHandlers;
+  stats.totalUpdateTime = impl->totalUpdateTime;
+  return stats;
+}
+
+
+networking::ConnectionStats
+Server::connectionStats(Connection connection) const {
+  const auto* channel = impl->channels.find(connection.id);
+  if (channel == nullptr) {
+    return {};
+  }
+  const auto& traffic = (*channel)->getTraffic();
+  return {traffic.messagesIn.get(), traffic.bytesIn.get(),
+          traffic.messagesOut.get(), traffic.bytesOut.get(),
+          (*channel)->getQueueDepth()};
+}
+
+
+networking::QueueDepth
+Server::queueDepth(Connection connection) const {
+  const auto* channel = impl->channels.find(connection.id);
+  return channel == nullptr ? networking::QueueDepth{}
+                            : (*channel)->getQueueDepth();
+}
+
+
+networking::CompressionStats
+Server::compressionStats() const {
+  networking::CompressionStats stats;
+  for (const auto& shard : impl->shards) {
+    shard->compression.addTo(stats);
   }
+  return stats;
 }
 
 
 std::unique_ptr<ServerImpl,ServerImplDeleter>
 Server::buildImpl(Server& server,
                   unsigned short port,
-                  std::string httpMessage) {
+                  std::string httpMessage,
+                  ServerOptions options) {
   // NOTE: We are using a custom deleter here so that the impl class can be
   // hidden within the source file rather than exposed in the header. Using
   // a custom deleter means that we need to use a raw `new` rather than using
   // `std::make_unique`.
-  auto* impl = new ServerImpl(server, port, std::move(httpMessage));
+  auto* impl = new ServerImpl(server, port, std::move(httpMessage),
+                              std::move(options));
   return std::unique_ptr<ServerImpl,ServerImplDeleter>(impl);
 }
 
@@ -0,0 +1,176 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NETWORKING_SLOT_MAP_H
+#define NETWORKING_SLOT_MAP_H
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+
+namespace networking {
+
+
+/**
+ *  @class SlotMap
+ *
+ *  @brief A table of values addressed by generational keys.
+ *
+ *  A key packs a slot index into its low half and that slot's generation
+ *  into its high half. Looking a key up is an array access and a comparison
+ *  of generations, and erasing a value bumps its slot's generation, so keys
+ *  of erased values are rejected even after the slot has been reused. Key 0
+ *  is never handed out.
+ *
+ *  The values themselves are stored densely, in no particular order, so
+ *  iterating all of them walks contiguous memory. Erasing moves the last
+ *  value into the gap.
+ */
+template <typename T>
+class SlotMap {
+public:
+  using Key = uintptr_t;
+
+  [[nodiscard]] Key
+  insert(T value) {
+    uint32_t index = 0;
+    if (freeSlots.empty()) {
+      index = static_cast<uint32_t>(slots.size());
+      slots.push_back({1, 0});
+    } else {
+      index = freeSlots.back();
+      freeSlots.pop_back();
+    }
+    Slot& slot = slots[index];
+    slot.dense = static_cast<uint32_t>(values.size());
+    const Key key = pack(index, slot.generation);
+    values.push_back(std::move(value));
+    keys.push_back(key);
+    return key;
+  }
+
+  [[nodiscard]] T*
+  find(Key key) noexcept {
+    const Slot* slot = lookup(key);
+    return slot == nullptr ? nullptr : &values[slot->dense];
+  }
+
+  [[nodiscard]] const T*
+  find(Key key) const noexcept {
+    const Slot* slot = lookup(key);
+    return slot == nullptr ? nullptr : &values[slot->dense];
+  }
+
+  [[nodiscard]] bool contains(Key key) const noexcept { return lookup(key) != nullptr; }
+
+  /** Erase the value for `key`. Returns false if the key is stale. */
+  bool
+  erase(Key key) {
+    const Slot* found = lookup(key);
+    if (found == nullptr) {
+      return false;
+    }
+    const uint32_t index = indexOf(key);
+    const uint32_t dense = found->dense;
+    if (dense + 1 != values.size()) {
+      values[dense] = std::move(values.back());
+      keys[dense] = keys.back();
+      slots[indexOf(keys[dense])].dense = dense;
+    }
+    values.pop_back();
+    keys.pop_back();
+
+    Slot& slot = slots[index];
+    slot.generation = nextGeneration(slot.generation);
+    freeSlots.push_back(index);
+    return true;
+  }
+
+  void
+  clear() {
+    for (Key key : keys) {
+      Slot& slot = slots[indexOf(key)];
+      slot.generation = nextGeneration(slot.generation);
+      freeSlots.push_back(indexOf(key));
+    }
+    values.clear();
+    keys.clear();
+  }
+
+  [[nodiscard]] size_t size() const noexcept { return values.size(); }
+  [[nodiscard]] bool empty() const noexcept { return values.empty(); }
+
+  /** All values, densely packed. getKeys()[i] is the key of getValues()[i]. */
+  [[nodiscard]] std::span<T> getValues() noexcept { return values; }
+  [[nodiscard]] std::span<const T> getValues() const noexcept { return values; }
+  [[nodiscard]] std::span<const Key> getKeys() const noexcept { return keys; }
+
+private:
+  struct Slot {
+    uint32_t generation;
+    uint32_t dense;
+  };
+
+  // Half of the key for the index, half for the generation. On 32 bit
+  // targets that leaves 16 bits each.
+  static constexpr unsigned HALF_BITS = sizeof(Key) * CHAR_BIT / 2;
+  static constexpr Key HALF_MASK = (Key{1} << HALF_BITS) - 1;
+
+  static Key
+  pack(uint32_t index, uint32_t generation) noexcept {
+    return (static_cast<Key>(generation) << HALF_BITS) | index;
+  }
+
+  static uint32_t
+  indexOf(Key key) noexcept {
+    return static_cast<uint32_t>(key & HALF_MASK);
+  }
+
+  static uint32_t
+  generationOf(Key key) noexcept {
+    return static_cast<uint32_t>(key >> HALF_BITS);
+  }
+
+  // Generations skip zero so that no key is ever 0.
+  static uint32_t
+  nextGeneration(uint32_t generation) noexcept {
+    const auto next = static_cast<uint32_t>((generation + 1) & HALF_MASK);
+    return next == 0 ? 1 : next;
+  }
+
+  const Slot*
+  lookup(Key key) const noexcept {
+    const uint32_t index = indexOf(key);
+    if (index >= slots.size()) {
+      return nullptr;
+    }
+    // Checking the dense key as well rejects keys that name a free slot's
+    // next generation, which was never handed out.
+    const Slot& slot = slots[index];
+    if (slot.generation != generationOf(key)
+        || slot.dense >= keys.size() || keys[slot.dense] != key) {
+      return nullptr;
+    }
+    return &slot;
+  }
+
+  std::vector<T> values;
+  std::vector<Key> keys;
+  std::vector<Slot> slots;
+  std::vector<uint32_t> freeSlots;
+};
+
+
+}
+
+
+#endif
@@ -0,0 +1,338 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NETWORKING_STATIC_FILES_H
+#define NETWORKING_STATIC_FILES_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+
+namespace networking {
+
+
+/**
+ *  Maps request targets onto the files under a root directory and keeps the
+ *  contents of small files in a bounded LRU cache. An entry is revalidated
+ *  against the file's size and modification time on every lookup, so edits
+ *  on disk are picked up without a restart.
+ *
+ *  Shards look files up concurrently, so the cache is guarded by a mutex.
+ *  Files are read outside of the lock.
+ */
+class StaticFiles {
+public:
+  struct File {
+    std::filesystem::path path;
+    std::string_view contentType;
+    std::string etag;
+    uint64_t size = 0;
+    std::filesystem::file_time_type modified;
+    // The whole file for cached files, null for files sent from disk.
+    std::shared_ptr<const std::string> contents;
+  };
+
+  StaticFiles(std::filesystem::path root,
+              size_t cacheBytes,
+              size_t maxCachedFileBytes)
+    : root{std::move(root)},
+      cacheBytes{cacheBytes},
+      maxCachedFileBytes{maxCachedFileBytes}
+      { }
+
+  /**
+   *  Find the file for an HTTP request target. Returns null when the target
+   *  names nothing servable, including any attempt to leave the root.
+   */
+  [[nodiscard]] std::shared_ptr<const File>
+  find(std::string_view target) {
+    auto path = resolve(target);
+    if (!path) {
+      return nullptr;
+    }
+
+    std::error_code error;
+    if (std::filesystem::is_directory(*path, error)) {
+      *path /= "index.html";
+    }
+    if (!std::filesystem::is_regular_file(*path, error)) {
+      return nullptr;
+    }
+    const auto size = std::filesystem::file_size(*path, error);
+    if (error) {
+      return nullptr;
+    }
+    const auto modified = std::filesystem::last_write_time(*path, error);
+    if (error) {
+      return nullptr;
+    }
+
+    std::string key = path->string();
+    if (auto cached = lookup(key, size, modified)) {
+      return cached;
+    }
+
+    auto file = std::make_shared<File>();
+    file->path = std::move(*path);
+    file->contentType = contentTypeFor(file->path);
+    file->etag = makeETag(size, modified);
+    file->size = size;
+    file->modified = modified;
+    if (size > maxCachedFileBytes || size > cacheBytes) {
+      return file;
+    }
+
+    std::ifstream stream{file->path, std::ios::binary};
+    std::string contents{std::istreambuf_iterator<char>{stream}, {}};
+    if (!stream.good() && !stream.eof()) {
+      return nullptr;
+    }
+    // The file changed between the stat and the read. Serve what was read,
+    // but keep it out of the cache so that the next request stats again.
+    if (contents.size() != size) {
+      file->size = contents.size();
+      file->contents = std::make_shared<const std::string>(std::move(contents));
+      return file;
+    }
+    file->contents = std::make_shared<const std::string>(std::move(contents));
+    insert(std::move(key), file);
+    return file;
+  }
+
+  /** True if an If-None-Match header value lists `etag` or is "*". */
+  [[nodiscard]] static bool
+  matchesETag(std::string_view ifNoneMatch, std::string_view etag) {
+    while (!ifNoneMatch.empty()) {
+      const size_t comma = ifNoneMatch.find(',');
+      std::string_view candidate = ifNoneMatch.substr(0, comma);
+      ifNoneMatch.remove_prefix(comma == std::string_view::npos
+                                ? ifNoneMatch.size() : comma + 1);
+
+      while (!candidate.empty() && candidate.front() == ' ') {
+        candidate.remove_prefix(1);
+      }
+      while (!candidate.empty() && candidate.back() == ' ') {
+        candidate.remove_suffix(1);
+      }
+      // If-None-Match uses the weak comparison.
+      if (candidate.starts_with("W/")) {
+        candidate.remove_prefix(2);
+      }
+      if (candidate == "*" || candidate == etag) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  [[nodiscard]] static std::string_view
+  contentTypeFor(const std::filesystem::path& path) {
+    static constexpr std::pair<std::string_view, std::string_view> TYPES[] = {
+      {".html",  "text/html; charset=utf-8"},
+      {".htm",   "text/html; charset=utf-8"},
+      {".js",    "text/javascript; charset=utf-8"},
+      {".mjs",   "text/javascript; charset=utf-8"},
+      {".css",   "text/css; charset=utf-8"},
+      {".json",  "application/json"},
+      {".map",   "application/json"},
+      {".wasm",  "application/wasm"},
+      {".txt",   "text/plain; charset=utf-8"},
+      {".xml",   "application/xml"},
+      {".svg",   "image/svg+xml"},
+      {".png",   "image/png"},
+      {".jpg",   "image/jpeg"},
+      {".jpeg",  "image/jpeg"},
+      {".gif",   "image/gif"},
+      {".webp",  "image/webp"},
+      {".ico",   "image/x-icon"},
+      {".woff",  "font/woff"},
+      {".woff2", "font/woff2"},
+      {".ttf",   "font/ttf"},
+      {".mp3",   "audio/mpeg"},
+      {".ogg",   "audio/ogg"},
+      {".wav",   "audio/wav"},
+      {".mp4",   "video/mp4"},
+      {".webm",  "video/webm"},
+      {".pdf",   "application/pdf"},
+    };
+    const std::string extension = path.extension().string();
+    for (auto [suffix, type] : TYPES) {
+      if (extension.size() == suffix.size()
+          && std::equal(extension.begin(), extension.end(), suffix.begin(),
+                        [](char a, char b) { return toLower(a) == b; })) {
+        return type;
+      }
+    }
+    return "application/octet-stream";
+  }
+
+private:
+  struct CacheEntry {
+    std::string key;
+    std::shared_ptr<const File> file;
+  };
+  using LruList = std::list<CacheEntry>;
+
+  static char
+  toLower(char c) noexcept {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+  }
+
+  static int
+  hexValue(char c) noexcept {
+    if (c >= '0' && c <= '9') { return c - '0'; }
+    c = toLower(c);
+    if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+    return -1;
+  }
+
+  static std::string
+  makeETag(uint64_t size, std::filesystem::file_time_type modified) {
+    static constexpr char DIGITS[] = "0123456789abcdef";
+    auto appendHex = [](std::string& out, uint64_t value) {
+      char digits[16];
+      int count = 0;
+      do {
+        digits[count++] = DIGITS[value & 0xf];
+        value >>= 4;
+      } while (value != 0);
+      while (count > 0) {
+        out.push_back(digits[--count]);
+      }
+    };
+    std::string etag = "\"";
+    appendHex(etag, size);
+    etag.push_back('-');
+    appendHex(etag, static_cast<uint64_t>(modified.time_since_epoch().count()));
+    etag.push_back('"');
+    return etag;
+  }
+
+  // Percent decodes the path of a target and joins it onto the root. Empty
+  // segments and "." are skipped, and ".." or an embedded NUL or slash
+  // rejects the target outright, so the result never escapes the root.
+  std::optional<std::filesystem::path>
+  resolve(std::string_view target) const {
+    target = target.substr(0, target.find_first_of("?#"));
+    if (!target.starts_with('/')) {
+      return std::nullopt;
+    }
+
+    std::filesystem::path path = root;
+    std::string segment;
+    auto finishSegment = [&] {
+      if (segment == "..") {
+        return false;
+      }
+      if (!segment.empty() && segment != ".") {
+        path /= segment;
+      }
+      segment.clear();
+      return true;
+    };
+
+    for (size_t i = 1; i < target.size(); ++i) {
+      char c = target[i];
+      if (c == '/') {
+        if (!finishSegment()) {
+          return std::nullopt;
+        }
+        continue;
+      }
+      if (c == '%') {
+        if (i + 2 >= target.size()) {
+          return std::nullopt;
+        }
+        const int high = hexValue(target[i + 1]);
+        const int low = hexValue(target[i + 2]);
+        if (high < 0 || low < 0) {
+          return std::nullopt;
+        }
+        c = static_cast<char>(high * 16 + low);
+        i += 2;
+        if (c == '\0' || c == '/') {
+          return std::nullopt;
+        }
+      }
+      if (c == '\\') {
+        return std::nullopt;
+      }
+      segment.push_back(c);
+    }
+    if (!finishSegment()) {
+      return std::nullopt;
+    }
+    return path;
+  }
+
+  std::shared_ptr<const File>
+  lookup(const std::string& key,
+         uint64_t size,
+         std::filesystem::file_time_type modified) {
+    std::lock_guard lock{mutex};
+    auto found = index.find(key);
+    if (found == index.end()) {
+      return nullptr;
+    }
+    auto entry = found->second;
+    if (entry->file->size != size || entry->file->modified != modified) {
+      cachedBytes -= entry->file->size;
+      lru.erase(entry);
+      index.erase(found);
+      return nullptr;
+    }
+    lru.splice(lru.begin(), lru, entry);
+    return entry->file;
+  }
+
+  void
+  insert(std::string key, std::shared_ptr<const File> file) {
+    std::lock_guard lock{mutex};
+    if (auto found = index.find(key); found != index.end()) {
+      cachedBytes -= found->second->file->size;
+      lru.erase(found->second);
+      index.erase(found);
+    }
+    while (!lru.empty() && cachedBytes + file->size > cacheBytes) {
+      cachedBytes -= lru.back().file->size;
+      index.erase(lru.back().key);
+      lru.pop_back();
+    }
+    cachedBytes += file->size;
+    lru.push_front({key, std::move(file)});
+    index.emplace(std::move(key), lru.begin());
+  }
+
+  const std::filesystem::path root;
+  const size_t cacheBytes;
+  const size_t maxCachedFileBytes;
+
+  std::mutex mutex;
+  LruList lru;
+  std::unordered_map<std::string, LruList::iterator> index;
+  size_t cachedBytes = 0;
+};
+
+
+}
+
+
+#endif
@@ -0,0 +1,81 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NETWORKING_TIMER_WHEEL_H
+#define NETWORKING_TIMER_WHEEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace networking {
+
+
+/**
+ *  @class TimerWheel
+ *
+ *  @brief A hashed timing wheel of keys, advanced one tick at a time.
+ *
+ *  Scheduling a key appends it to the slot of the tick it is due in, and
+ *  advancing the wheel hands every key of the new tick to a callback. Both
+ *  are constant time, independent of how many keys are pending, which suits
+ *  per-connection deadlines by the hundred thousand far better than a timer
+ *  each.
+ *
+ *  Keys are not removed early. Owners look them up when they expire and
+ *  ignore the ones that have gone stale. A delay longer than the wheel's span
+ *  expires at the end of the span, so owners re-check and reschedule then.
+ */
+template <typename Key>
+class TimerWheel {
+public:
+  using Tick = uint64_t;
+
+  explicit TimerWheel(size_t slotCount)
+    : slots(std::max<size_t>(slotCount, 2))
+      { }
+
+  [[nodiscard]] Tick now() const noexcept { return current; }
+
+  /** Expire `key` after `delay` ticks, but at least one. */
+  void
+  schedule(Key key, Tick delay) {
+    delay = std::clamp<Tick>(delay, 1, slots.size() - 1);
+    slots[(current + delay) % slots.size()].push_back(key);
+  }
+
+  /**
+   *  Move to the next tick and call `onExpired` with each key due then. The
+   *  callback may schedule keys again.
+   */
+  template <typename OnExpired>
+  void
+  advance(OnExpired&& onExpired) {
+    ++current;
+    // Swapping the due keys out keeps rescheduling from touching the list
+    // being walked, and keeps both vectors' capacity in circulation.
+    expiring.clear();
+    std::swap(expiring, slots[current % slots.size()]);
+    for (Key key : expiring) {
+      onExpired(key);
+    }
+  }
+
+private:
+  std::vector<std::vector<Key>> slots;
+  std::vector<Key> expiring;
+  Tick current = 0;
+};
+
+
+}
+
+
+#endif
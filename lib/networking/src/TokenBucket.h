@@ -0,0 +1,61 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NETWORKING_TOKEN_BUCKET_H
+#define NETWORKING_TOKEN_BUCKET_H
+
+#include <algorithm>
+#include <chrono>
+
+
+namespace networking {
+
+
+/**
+ *  A rate limiter that admits `rate` events per second on average and up to
+ *  `burst` at once. Tokens are refilled lazily from the elapsed time when
+ *  one is taken, so an idle bucket costs nothing. A rate of zero or less
+ *  admits everything. Not thread safe.
+ */
+class TokenBucket {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  TokenBucket(double rate, double burst)
+    : rate{rate},
+      capacity{std::max(burst, 1.0)},
+      tokens{capacity}
+      { }
+
+  [[nodiscard]] bool
+  tryTake(Clock::time_point now = Clock::now()) noexcept {
+    if (rate <= 0) {
+      return true;
+    }
+    const std::chrono::duration<double> elapsed = now - refilled;
+    tokens = std::min(capacity, tokens + elapsed.count() * rate);
+    refilled = now;
+    if (tokens < 1) {
+      return false;
+    }
+    tokens -= 1;
+    return true;
+  }
+
+private:
+  const double rate;
+  const double capacity;
+  double tokens;
+  Clock::time_point refilled = Clock::now();
+};
+
+
+}
+
+
+#endif
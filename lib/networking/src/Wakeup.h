@@ -0,0 +1,99 @@
+/////////////////////////////////////////////////////////////////////////////
+//                         Single Threaded Networking
+//
+// This file is distributed under the MIT License. See the LICENSE file
+// for details.
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef NETWORKING_WAKEUP_H
+#define NETWORKING_WAKEUP_H
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <cstdint>
+
+
+namespace networking {
+
+
+/**
+ *  A file descriptor that an external event loop can wait on. notify() makes
+ *  it readable and clear() makes it unreadable again, so it stays readable
+ *  for as long as work is pending. Linux uses an eventfd, other POSIX systems
+ *  a nonblocking pipe. Windows has no equivalent, and handle() is -1 there.
+ */
+class Wakeup {
+public:
+  Wakeup() {
+#if defined(__linux__)
+    readEnd = writeEnd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif !defined(_WIN32)
+    int ends[2];
+    if (::pipe(ends) == 0) {
+      for (int end : ends) {
+        ::fcntl(end, F_SETFL, ::fcntl(end, F_GETFL) | O_NONBLOCK);
+        ::fcntl(end, F_SETFD, FD_CLOEXEC);
+      }
+      readEnd = ends[0];
+      writeEnd = ends[1];
+    }
+#endif
+  }
+
+  ~Wakeup() {
+#if !defined(_WIN32)
+    if (readEnd >= 0) {
+      ::close(readEnd);
+    }
+    if (writeEnd >= 0 && writeEnd != readEnd) {
+      ::close(writeEnd);
+    }
+#endif
+  }
+
+  Wakeup(const Wakeup&) = delete;
+  Wakeup(Wakeup&&) = delete;
+  Wakeup& operator=(const Wakeup&) = delete;
+  Wakeup& operator=(Wakeup&&) = delete;
+
+  [[nodiscard]] int handle() const noexcept { return readEnd; }
+
+  void
+  notify() noexcept {
+#if !defined(_WIN32)
+    if (writeEnd >= 0) {
+      // A full pipe or a saturated eventfd is already readable, so a failed
+      // write loses nothing.
+      const uint64_t one = 1;
+      [[maybe_unused]] auto written = ::write(writeEnd, &one, sizeof(one));
+    }
+#endif
+  }
+
+  void
+  clear() noexcept {
+#if !defined(_WIN32)
+    if (readEnd >= 0) {
+      uint64_t drained[16];
+      while (::read(readEnd, drained, sizeof(drained)) > 0) { }
+    }
+#endif
+  }
+
+private:
+  int readEnd = -1;
+  int writeEnd = -1;
+};
+
+
+}
+
+
+#endif
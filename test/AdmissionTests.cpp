@@ -0,0 +1,117 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+using networking::Client;
+using networking::Connection;
+using networking::Server;
+using networking::ServerOptions;
+using testhelpers::connectTcp;
+using testhelpers::httpExchange;
+using testhelpers::pumpUntil;
+
+namespace {
+
+const std::string CLOSE_REQUEST =
+  "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+
+class Admission : public ::testing::Test {
+protected:
+  void start(ServerOptions options) {
+    server.emplace(0, "<html>ok</html>",
+                   [this](Connection c) { connects.push_back(c); },
+                   [this](Connection) { ++disconnects; },
+                   std::move(options));
+  }
+
+  // Connects without sending anything and returns whatever the server sends
+  // before closing the connection.
+  std::string silentExchange() {
+    const int fd = connectTcp(server->getPort());
+    if (fd < 0) {
+      return {};
+    }
+    std::string response;
+    pumpUntil([&] {
+      char buffer[256];
+      const ssize_t count = ::recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if (count > 0) {
+        response.append(buffer, static_cast<size_t>(count));
+        return false;
+      }
+      return count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+    }, &*server, {}, 500);
+    ::close(fd);
+    return response;
+  }
+
+  std::optional<Server> server;
+  std::vector<Connection> connects;
+  size_t disconnects = 0;
+};
+
+TEST_F(Admission, ConnectionsOverTheLimitGetServiceUnavailable) {
+  ServerOptions options;
+  options.admission.maxConnections = 2;
+  start(options);
+
+  const std::string port = std::to_string(server->getPort());
+  std::optional<Client> first{std::in_place, "localhost", port};
+  Client second{"localhost", port};
+  ASSERT_TRUE(pumpUntil([&] { return connects.size() == 2; },
+                        &*server, {&*first, &second}));
+
+  EXPECT_NE(silentExchange().find("503 Service Unavailable"),
+            std::string::npos);
+  auto stats = server->stats();
+  EXPECT_EQ(stats.rejectedOverCapacity, 1u);
+  EXPECT_EQ(stats.acceptedConnections, 2u);
+
+  // Closing a connection frees its place for the next one.
+  first.reset();
+  ASSERT_TRUE(pumpUntil([&] { return disconnects == 1; },
+                        &*server, {&second}));
+  EXPECT_NE(httpExchange(*server, server->getPort(), CLOSE_REQUEST)
+              .find("200 OK"),
+            std::string::npos);
+  EXPECT_EQ(server->stats().rejectedOverCapacity, 1u);
+}
+
+TEST_F(Admission, AcceptsBeyondTheBurstAreRateLimited) {
+  ServerOptions options;
+  options.admission.acceptsPerSecond = 0.01;
+  options.admission.acceptBurst = 2;
+  start(options);
+
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_NE(httpExchange(*server, server->getPort(), CLOSE_REQUEST)
+                .find("200 OK"),
+              std::string::npos);
+  }
+  EXPECT_NE(silentExchange().find("503 Service Unavailable"),
+            std::string::npos);
+  EXPECT_NE(silentExchange().find("503 Service Unavailable"),
+            std::string::npos);
+
+  const auto stats = server->stats();
+  EXPECT_EQ(stats.acceptedConnections, 2u);
+  EXPECT_EQ(stats.rejectedOverRate, 2u);
+  EXPECT_EQ(stats.rejectedOverCapacity, 0u);
+}
+
+TEST_F(Admission, CustomBacklogStillServes) {
+  ServerOptions options;
+  options.admission.listenBacklog = 4;
+  start(options);
+
+  EXPECT_NE(httpExchange(*server, server->getPort(), CLOSE_REQUEST)
+              .find("200 OK"),
+            std::string::npos);
+  EXPECT_EQ(server->stats().acceptedConnections, 1u);
+}
+
+}  // namespace
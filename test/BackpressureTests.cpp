@@ -0,0 +1,138 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <deque>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+using networking::Client;
+using networking::Connection;
+using networking::Message;
+using networking::OutboundLimits;
+using networking::OverflowPolicy;
+using networking::Server;
+using networking::ServerOptions;
+using testhelpers::ServerAndClient;
+using testhelpers::pumpUntil;
+
+namespace {
+
+// A single send() of many messages fills the queue before any is written.
+class Backpressure : public ServerAndClient {
+protected:
+  void start(OutboundLimits limits) {
+    ServerOptions options;
+    options.outboundLimits = limits;
+    options.onOverflow = [this](Connection c, OverflowPolicy policy) {
+      overflows.emplace_back(c, policy);
+    };
+    ServerAndClient::start(std::move(options));
+  }
+
+  void sendNumbered(int count) {
+    std::deque<Message> messages;
+    for (int i = 0; i < count; ++i) {
+      messages.push_back({connects.front(), std::to_string(i) + ";"});
+    }
+    server->send(messages);
+  }
+
+  std::vector<std::pair<Connection, OverflowPolicy>> overflows;
+};
+
+TEST_F(Backpressure, UnlimitedByDefault) {
+  start({});
+  sendNumbered(1000);
+  EXPECT_EQ(server->queueDepth(connects.front()).messages, 1000u);
+  server->update();
+  EXPECT_TRUE(overflows.empty());
+}
+
+TEST_F(Backpressure, DropNewestKeepsTheQueuedMessages) {
+  start({.maxQueuedMessages = 3, .policy = OverflowPolicy::DropNewest});
+  sendNumbered(5);
+  const auto depth = server->queueDepth(connects.front());
+  EXPECT_EQ(depth.messages, 3u);
+  EXPECT_EQ(depth.bytes, 6u);
+
+  EXPECT_EQ(receiveAtLeast(6), "0;1;2;");
+  ASSERT_EQ(overflows.size(), 2u);
+  EXPECT_EQ(overflows.front().first, connects.front());
+  EXPECT_EQ(overflows.front().second, OverflowPolicy::DropNewest);
+}
+
+TEST_F(Backpressure, DropOldestKeepsTheLatestBytes) {
+  start({.maxQueuedBytes = 4, .policy = OverflowPolicy::DropOldest});
+  sendNumbered(5);
+  EXPECT_EQ(server->queueDepth(connects.front()).bytes, 4u);
+
+  EXPECT_EQ(receiveAtLeast(4), "3;4;");
+  EXPECT_EQ(overflows.size(), 3u);
+}
+
+TEST_F(Backpressure, DisconnectPolicyDropsTheSlowClient) {
+  start({.maxQueuedMessages = 2, .policy = OverflowPolicy::Disconnect});
+  sendNumbered(3);
+  EXPECT_EQ(server->queueDepth(connects.front()).messages, 0u);
+
+  ASSERT_TRUE(pumpUntil([&] { return !disconnects.empty(); },
+                        &*server, {&*client}));
+  ASSERT_EQ(overflows.size(), 1u);
+  EXPECT_EQ(overflows.front().second, OverflowPolicy::Disconnect);
+  EXPECT_TRUE(pumpUntil([&] { return client->isDisconnected(); },
+                        &*server, {&*client}));
+  EXPECT_EQ(server->queueDepth(connects.front()).messages, 0u);
+}
+
+TEST_F(Backpressure, QueueDrainsAsMessagesAreWritten) {
+  start({.maxQueuedMessages = 100});
+  sendNumbered(10);
+  EXPECT_EQ(server->queueDepth(connects.front()).messages, 10u);
+  receiveAtLeast(20);
+  EXPECT_EQ(server->queueDepth(connects.front()).messages, 0u);
+  EXPECT_EQ(server->queueDepth(connects.front()).bytes, 0u);
+}
+
+// A threaded shard applies sends after update() has posted them, so some of
+// them reach a channel that has already finished. Those must neither be
+// queued nor reported as overflows of a channel that is gone.
+TEST(BackpressureThreaded, SendsRacingADisconnectAreDropped) {
+  ServerOptions options;
+  options.ioThreads = 1;
+  options.outboundLimits = {.maxQueuedMessages = 1,
+                            .policy = OverflowPolicy::DropOldest};
+  std::vector<Connection> connects;
+  std::vector<Connection> disconnects;
+  Server server{0, "",
+                [&](Connection c) { connects.push_back(c); },
+                [&](Connection c) { disconnects.push_back(c); },
+                options};
+  std::optional<Client> client{std::in_place, "localhost",
+                               std::to_string(server.getPort())};
+  ASSERT_TRUE(pumpUntil([&] { return !connects.empty(); },
+                        &server, {&*client}));
+
+  const auto sendBurst = [&] {
+    std::deque<Message> messages;
+    for (int i = 0; i < 4; ++i) {
+      messages.push_back({connects.front(), std::to_string(i) + ";"});
+    }
+    server.send(messages);
+  };
+  client.reset();
+  for (int i = 0; i < 2000 && disconnects.empty(); ++i) {
+    sendBurst();
+    server.update(std::chrono::milliseconds(1));
+  }
+  for (int i = 0; i < 50; ++i) {
+    sendBurst();
+    server.update(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(disconnects.size(), 1u);
+}
+
+}  // namespace
@@ -0,0 +1,125 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+using networking::Client;
+using networking::ClientOptions;
+using networking::CompressionOptions;
+using networking::Connection;
+using networking::Message;
+using networking::Server;
+using networking::ServerOptions;
+using testhelpers::ServerAndClient;
+using testhelpers::pumpUntil;
+
+namespace {
+
+// A server and one client, each with its own compression settings.
+class Compression : public ServerAndClient {
+protected:
+  void start(CompressionOptions serverSide, CompressionOptions clientSide) {
+    ServerOptions options;
+    options.compression = serverSide;
+    ClientOptions clientOptions;
+    clientOptions.compression = clientSide;
+    ServerAndClient::start(options, clientOptions);
+  }
+
+  // Sends `text` from the client to the server and back. Returns what came
+  // back, or nothing if the server did not get `text` first.
+  std::string roundTrip(const std::string& text) {
+    client->send(text);
+    std::deque<Message> atServer;
+    pumpUntil(
+        [&] {
+          auto batch = server->receive();
+          atServer.insert(atServer.end(), batch.begin(), batch.end());
+          return !atServer.empty();
+        },
+        &*server, {&*client});
+
+    server->send(std::deque<Message>{Message{connects.front(), text}});
+    const std::string atClient = receiveAtLeast(text.size());
+    return atServer.empty() || atServer.front().text != text ? "" : atClient;
+  }
+};
+
+std::string repetitiveJson() {
+  std::string text = "[";
+  for (int i = 0; i < 200; ++i) {
+    text += R"({"entity":"player","x":12.5,"y":-3.25,"state":"idle"},)";
+  }
+  text += "{}]";
+  return text;
+}
+
+TEST_F(Compression, NegotiatedDeflateShrinksTrafficBothWays) {
+  start({.enabled = true}, {.enabled = true});
+  const std::string text = repetitiveJson();
+  EXPECT_EQ(roundTrip(text), text);
+
+  const auto serverStats = server->compressionStats();
+  EXPECT_EQ(serverStats.messages, 1u);
+  EXPECT_EQ(serverStats.payloadBytes, text.size());
+  EXPECT_LT(serverStats.ratio(), 0.5);
+
+  const auto clientStats = client->compressionStats();
+  EXPECT_EQ(clientStats.messages, 1u);
+  EXPECT_LT(clientStats.ratio(), 0.5);
+}
+
+TEST_F(Compression, SmallMessagesBelowTheThresholdStayUncompressed) {
+  CompressionOptions options{.enabled = true, .minMessageSize = 1 << 20};
+  start(options, options);
+  const std::string text = repetitiveJson();
+  EXPECT_EQ(roundTrip(text), text);
+  EXPECT_GT(server->compressionStats().ratio(), 1.0);
+}
+
+TEST_F(Compression, WithoutContextTakeoverEachMessageStandsAlone) {
+  CompressionOptions options{.enabled = true,
+                             .serverMaxWindowBits = 10,
+                             .clientMaxWindowBits = 10,
+                             .contextTakeover = false};
+  start(options, options);
+  for (int i = 0; i < 3; ++i) {
+    const std::string text = repetitiveJson() + std::to_string(i);
+    EXPECT_EQ(roundTrip(text), text);
+  }
+  EXPECT_EQ(server->compressionStats().messages, 3u);
+}
+
+TEST_F(Compression, FallsBackWhenOnlyOnePeerEnablesIt) {
+  start({.enabled = true}, {});
+  const std::string text = repetitiveJson();
+  EXPECT_EQ(roundTrip(text), text);
+  // The server meters its writes, but nothing was negotiated to shrink them.
+  EXPECT_GT(server->compressionStats().ratio(), 1.0);
+  EXPECT_EQ(client->compressionStats().messages, 0u);
+}
+
+TEST_F(Compression, InvalidSettingsAreRejectedUpFront) {
+  const auto makeServer = [](CompressionOptions options) {
+    Server server{0, "", [](Connection) { }, [](Connection) { },
+                  ServerOptions{.compression = options}};
+  };
+  EXPECT_THROW(makeServer({.enabled = true, .serverMaxWindowBits = 8}),
+               std::runtime_error);
+  EXPECT_THROW(makeServer({.enabled = true, .clientMaxWindowBits = 16}),
+               std::runtime_error);
+  EXPECT_THROW(makeServer({.enabled = true, .level = 10}),
+               std::runtime_error);
+
+  Server server{0, "", [](Connection) { }, [](Connection) { }};
+  const std::string port = std::to_string(server.getPort());
+  EXPECT_THROW((Client{"localhost", port,
+                       ClientOptions{.compression = {.enabled = true,
+                                                     .serverMaxWindowBits = 20}}}),
+               std::runtime_error);
+}
+
+}  // namespace
@@ -3,14 +3,19 @@
 #include "gtest/gtest.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cstddef>
 #include <deque>
 #include <optional>
+#include <span>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 using networking::Client;
 using networking::Connection;
 using networking::Message;
+using networking::MessageType;
 using networking::Server;
 using testhelpers::pumpUntil;
 
@@ -100,6 +105,52 @@ TEST_F(EndToEnd, MultiClientFanoutIsIsolated) {
   EXPECT_EQ(gotTwo, "for two;");
 }
 
+TEST_F(EndToEnd, BroadcastReachesOnlyListedConnections) {
+  Client one{"localhost", portString};
+  ASSERT_TRUE(connectClients({&one}));
+  Client two{"localhost", portString};
+  ASSERT_TRUE(connectClients({&two}));
+  Client three{"localhost", portString};
+  ASSERT_TRUE(connectClients({&three}));
+
+  const std::vector<Connection> recipients{connects[0], connects[2]};
+  server->broadcast("shared;", recipients);
+  server->broadcast("everyone;");
+
+  std::string gotOne;
+  std::string gotTwo;
+  std::string gotThree;
+  ASSERT_TRUE(pumpUntil(
+      [&] {
+        gotOne += one.receive();
+        gotTwo += two.receive();
+        gotThree += three.receive();
+        return gotOne.size() == 16 && gotTwo.size() == 9
+               && gotThree.size() == 16;
+      },
+      &*server, {&one, &two, &three}));
+  EXPECT_EQ(gotOne, "shared;everyone;");
+  EXPECT_EQ(gotTwo, "everyone;");
+  EXPECT_EQ(gotThree, "shared;everyone;");
+}
+
+TEST_F(EndToEnd, BroadcastSkipsDisconnectedConnections) {
+  Client client{"localhost", portString};
+  ASSERT_TRUE(connectClients({&client}));
+  const Connection stale{connects.front().id + 1000};
+
+  const std::vector<Connection> recipients{stale, connects.front()};
+  server->broadcast("still delivered", recipients);
+  std::string got;
+  ASSERT_TRUE(pumpUntil(
+      [&] {
+        got += client.receive();
+        return !got.empty();
+      },
+      &*server, {&client}));
+  EXPECT_EQ(got, "still delivered");
+}
+
 TEST_F(EndToEnd, MessageOrderIsPreservedBothDirections) {
   Client client{"localhost", portString};
   ASSERT_TRUE(connectClients({&client}));
@@ -136,6 +187,207 @@ TEST_F(EndToEnd, MessageOrderIsPreservedBothDirections) {
   EXPECT_EQ(atClient, expected);
 }
 
+TEST_F(EndToEnd, BatchedAndOversizedMessagesKeepTheirOrder) {
+  Client client{"localhost", portString};
+  ASSERT_TRUE(connectClients({&client}));
+
+  // Small messages are coalesced into batched writes, while the oversized
+  // ones bypass the batch. Both must come out in the original order.
+  std::deque<Message> outbound;
+  std::string expected;
+  for (int i = 0; i < 6; ++i) {
+    std::string text = (i % 3 == 1) ? std::string(100'000, 'a' + i)
+                                    : "small " + std::to_string(i) + ";";
+    expected += text;
+    outbound.push_back(Message{connects.front(), std::move(text)});
+  }
+  server->send(outbound);
+
+  std::string got;
+  ASSERT_TRUE(pumpUntil(
+      [&] {
+        got += client.receive();
+        return got.size() >= expected.size();
+      },
+      &*server, {&client}));
+  EXPECT_EQ(got, expected);
+}
+
+TEST_F(EndToEnd, BinaryMessagesRoundTripWithoutTextValidation) {
+  Client client{"localhost", portString};
+  ASSERT_TRUE(connectClients({&client}));
+
+  // Not valid UTF-8, so this would fail the connection if sent as text.
+  const std::vector<std::byte> payload{std::byte{0xff}, std::byte{0x00},
+                                       std::byte{0xc3}, std::byte{0x28},
+                                       std::byte{0x80}};
+  client.send("before");
+  client.send(payload);
+  client.send("after");
+
+  std::deque<Message> received;
+  ASSERT_TRUE(pumpUntil(
+      [&] {
+        auto batch = server->receive();
+        received.insert(received.end(), batch.begin(), batch.end());
+        return received.size() >= 3;
+      },
+      &*server, {&client}));
+  ASSERT_EQ(received.size(), 3u);
+  EXPECT_EQ(received[0].type, MessageType::Text);
+  EXPECT_EQ(received[1].type, MessageType::Binary);
+  EXPECT_EQ(received[1].text.size(), payload.size());
+  EXPECT_TRUE(std::equal(payload.begin(), payload.end(),
+                         received[1].text.begin(),
+                         [](std::byte b, char c) {
+                           return b == static_cast<std::byte>(c);
+                         }));
+  EXPECT_EQ(received[2].type, MessageType::Text);
+  EXPECT_EQ(received[2].text, "after");
+
+  server->send(connects.front(), payload);
+  server->broadcast("text");
+  std::deque<std::vector<std::byte>> binary;
+  std::string text;
+  ASSERT_TRUE(pumpUntil(
+      [&] {
+        auto batch = client.receiveBinary();
+        binary.insert(binary.end(), batch.begin(), batch.end());
+        text += client.receive();
+        return !binary.empty() && text.size() >= 4;
+      },
+      &*server, {&client}));
+  ASSERT_EQ(binary.size(), 1u);
+  EXPECT_EQ(binary.front(), payload);
+  EXPECT_EQ(text, "text");
+  EXPECT_FALSE(client.isDisconnected());
+}
+
+TEST_F(EndToEnd, RecycledReceiveBuffersStartEmpty) {
+  Client client{"localhost", portString};
+  ASSERT_TRUE(connectClients({&client}));
+
+  // Each round hands its buffers back before the next, shorter message is
+  // read, so stale bytes would show up as trailing garbage.
+  for (size_t length : {4096u, 1000u, 64u, 1u}) {
+    const std::string text(length, 'a' + static_cast<char>(length % 26));
+    client.send(text);
+    std::deque<Message> received;
+    ASSERT_TRUE(pumpUntil(
+        [&] {
+          received = server->receive();
+          return !received.empty();
+        },
+        &*server, {&client}));
+    ASSERT_EQ(received.size(), 1u);
+    EXPECT_EQ(received.front().text, text);
+    server->recycle(std::move(received));
+    EXPECT_TRUE(received.empty());
+  }
+}
+
+TEST_F(EndToEnd, ReceiveIntoReplacesThePreviousBatch) {
+  Client client{"localhost", portString};
+  ASSERT_TRUE(connectClients({&client}));
+
+  std::vector<Message> received;
+  for (int round = 0; round < 3; ++round) {
+    const std::string first = "round " + std::to_string(round) + " a";
+    const std::string second = "round " + std::to_string(round) + " b";
+    client.send(first);
+    client.send(second);
+
+    std::vector<std::string> texts;
+    ASSERT_TRUE(pumpUntil(
+        [&] {
+          server->receiveInto(received);
+          for (const auto& message : received) {
+            EXPECT_EQ(message.connection, connects.front());
+            texts.push_back(message.text);
+          }
+          return texts.size() >= 2;
+        },
+        &*server, {&client}));
+    EXPECT_EQ(texts, (std::vector<std::string>{first, second}));
+  }
+}
+
+TEST_F(EndToEnd, TimedUpdateBlocksOnlyUntilTrafficArrives) {
+  using namespace std::chrono_literals;
+  Client client{"localhost", portString};
+  ASSERT_TRUE(connectClients({&client}));
+
+  // Nothing happens, so the full wait elapses.
+  auto start = std::chrono::steady_clock::now();
+  server->update(50ms);
+  EXPECT_GE(std::chrono::steady_clock::now() - start, 40ms);
+
+  // A message wakes the server long before the timeout.
+  client.send("wake up");
+  client.update();
+  start = std::chrono::steady_clock::now();
+  std::deque<Message> received;
+  while (received.empty() && std::chrono::steady_clock::now() - start < 10s) {
+    server->update(5s);
+    received = server->receive();
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start, 2s);
+  ASSERT_EQ(received.size(), 1u);
+  EXPECT_EQ(received.front().text, "wake up");
+
+  // And the client is woken by the reply the same way.
+  server->send({Message{connects.front(), "reply"}});
+  std::string reply;
+  start = std::chrono::steady_clock::now();
+  while (reply.empty() && std::chrono::steady_clock::now() - start < 10s) {
+    server->update();
+    client.update(5s);
+    reply = client.receive();
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start, 2s);
+  EXPECT_EQ(reply, "reply");
+}
+
+TEST_F(EndToEnd, StatsCountConnectionsAndTraffic) {
+  Client client{"localhost", portString};
+  ASSERT_TRUE(connectClients({&client}));
+
+  client.send("12345");
+  ASSERT_TRUE(pumpUntil([&] { return !server->receive().empty(); },
+                        &*server, {&client}));
+  server->send({Message{connects.front(), "abc"}});
+  ASSERT_TRUE(pumpUntil([&] { return client.receive() == "abc"; },
+                        &*server, {&client}));
+  // The write is counted once its completion has been handled.
+  ASSERT_TRUE(pumpUntil([&] { return server->stats().messagesOut == 1; },
+                        &*server, {&client}));
+
+  auto stats = server->stats();
+  EXPECT_EQ(stats.acceptedConnections, 1u);
+  EXPECT_EQ(stats.acceptErrors, 0u);
+  EXPECT_EQ(stats.activeConnections, 1u);
+  EXPECT_EQ(stats.closedConnections, 0u);
+  EXPECT_EQ(stats.messagesIn, 1u);
+  EXPECT_EQ(stats.bytesIn, 5u);
+  EXPECT_EQ(stats.messagesOut, 1u);
+  EXPECT_EQ(stats.bytesOut, 3u);
+  EXPECT_GT(stats.updates, 0u);
+  EXPECT_GT(stats.totalUpdateHandlers, 0u);
+
+  const auto perConnection = server->connectionStats(connects.front());
+  EXPECT_EQ(perConnection.messagesIn, 1u);
+  EXPECT_EQ(perConnection.bytesIn, 5u);
+  EXPECT_EQ(perConnection.messagesOut, 1u);
+  EXPECT_EQ(perConnection.bytesOut, 3u);
+
+  server->disconnect(connects.front());
+  stats = server->stats();
+  EXPECT_EQ(stats.activeConnections, 0u);
+  EXPECT_EQ(stats.closedConnections, 1u);
+  EXPECT_EQ(stats.messagesIn, 1u);
+  EXPECT_EQ(server->connectionStats(connects.front()).messagesIn, 0u);
+}
+
 TEST_F(EndToEnd, ClientDestructionLeadsToDisconnectCallback) {
   {
     Client client{"localhost", portString};
@@ -147,7 +399,8 @@ TEST_F(EndToEnd, ClientDestructionLeadsToDisconnectCallback) {
 
 TEST_F(EndToEnd, HttpGetServesTheConfiguredPage) {
   const std::string response = testhelpers::httpExchange(
-      *server, port, "GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n");
+      *server, port, "GET /index.html HTTP/1.1\r\nHost: localhost\r\n"
+      "Connection: close\r\n\r\n");
   EXPECT_NE(response.find("200"), std::string::npos);
   EXPECT_NE(response.find("<html>test-page</html>"), std::string::npos);
 }
@@ -167,11 +420,108 @@ TEST_F(EndToEnd, ServerDisconnectFiresCallbackAndClientObserves) {
 
 TEST_F(EndToEnd, HttpHeadReturnsHeadersOnly) {
   const std::string response = testhelpers::httpExchange(
-      *server, port, "HEAD /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n");
+      *server, port, "HEAD /index.html HTTP/1.1\r\nHost: localhost\r\n"
+      "Connection: close\r\n\r\n");
   EXPECT_NE(response.find("200"), std::string::npos);
   EXPECT_EQ(response.find("test-page"), std::string::npos);
 }
 
+TEST_F(EndToEnd, HttpPageIsGzippedWhenAccepted) {
+  std::string page = "<html>";
+  for (int i = 0; i < 200; ++i) {
+    page += "<p>repetitive</p>";
+  }
+  page += "</html>";
+  server.emplace(0, page, [](Connection) { }, [](Connection) { });
+
+  const std::string compressed = testhelpers::httpExchange(
+      *server, server->getPort(),
+      "GET / HTTP/1.1\r\nHost: localhost\r\n"
+      "Accept-Encoding: br, gzip;q=0.8\r\nConnection: close\r\n\r\n");
+  EXPECT_NE(compressed.find("Content-Encoding: gzip"), std::string::npos);
+  const size_t bodyStart = compressed.find("\r\n\r\n") + 4;
+  EXPECT_EQ(compressed.substr(bodyStart, 2), "\x1f\x8b");
+  EXPECT_LT(compressed.size() - bodyStart, page.size());
+
+  const std::string identity = testhelpers::httpExchange(
+      *server, server->getPort(),
+      "GET / HTTP/1.1\r\nHost: localhost\r\n"
+      "Accept-Encoding: gzip;q=0\r\nConnection: close\r\n\r\n");
+  EXPECT_EQ(identity.find("Content-Encoding"), std::string::npos);
+  EXPECT_NE(identity.find(page), std::string::npos);
+}
+
+TEST_F(EndToEnd, PipelinedHttpRequestsShareOneConnection) {
+  const std::string response = testhelpers::httpExchange(
+      *server, port,
+      "GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n"
+      "GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n"
+      "HEAD /index.html HTTP/1.1\r\nHost: localhost\r\n"
+      "Connection: close\r\n\r\n");
+  size_t responses = 0;
+  for (size_t at = response.find("HTTP/1.1 200"); at != std::string::npos;
+       at = response.find("HTTP/1.1 200", at + 1)) {
+    ++responses;
+  }
+  EXPECT_EQ(responses, 3u);
+  EXPECT_EQ(server->stats().acceptedConnections, 1u);
+}
+
+TEST_F(EndToEnd, IdleHttpConnectionsAreClosed) {
+  networking::ServerOptions options;
+  options.httpIdleTimeout = std::chrono::milliseconds{50};
+  server.emplace(0, "<html>test-page</html>",
+                 [this](Connection c) { connects.push_back(c); },
+                 [this](Connection c) { disconnects.push_back(c); },
+                 options);
+
+  const auto start = std::chrono::steady_clock::now();
+  const std::string response = testhelpers::httpExchange(
+      *server, server->getPort(),
+      "GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  EXPECT_NE(response.find("<html>test-page</html>"), std::string::npos);
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::seconds{1});
+}
+
+TEST_F(EndToEnd, NonPositiveHttpIdleTimeoutsAreRejected) {
+  for (auto timeout : {std::chrono::milliseconds{0},
+                       std::chrono::milliseconds{-1}}) {
+    networking::ServerOptions options;
+    options.httpIdleTimeout = timeout;
+    EXPECT_THROW((networking::Server{0, "", [](Connection) { },
+                                     [](Connection) { }, options}),
+                 std::runtime_error);
+  }
+}
+
+TEST_F(EndToEnd, UpgradeAfterHttpRequestStartsAChannel) {
+  const int fd = testhelpers::connectTcp(port);
+  ASSERT_GE(fd, 0);
+  const std::string requests =
+      "GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n"
+      "GET / HTTP/1.1\r\nHost: localhost\r\n"
+      "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+      "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+      "Sec-WebSocket-Version: 13\r\n\r\n";
+  ::send(fd, requests.data(), requests.size(), 0);
+
+  std::string response;
+  EXPECT_TRUE(pumpUntil(
+      [&] {
+        char buffer[4096];
+        const ssize_t count = ::recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (count > 0) {
+          response.append(buffer, static_cast<size_t>(count));
+        }
+        return connects.size() == 1
+            && response.find("101 Switching Protocols") != std::string::npos;
+      },
+      &*server, {}));
+  EXPECT_NE(response.find("<html>test-page</html>"), std::string::npos);
+  ::close(fd);
+}
+
 TEST_F(EndToEnd, ConnectionIdsAreNotReusedAcrossClients) {
   {
     Client client{"localhost", portString};
@@ -187,6 +537,35 @@ TEST_F(EndToEnd, ConnectionIdsAreNotReusedAcrossClients) {
   EXPECT_FALSE(connects[0] == connects[1]);
 }
 
+TEST_F(EndToEnd, StaleConnectionsDoNotReachNewClients) {
+  {
+    Client client{"localhost", portString};
+    ASSERT_TRUE(connectClients({&client}));
+  }
+  ASSERT_TRUE(pumpUntil([&] { return disconnects.size() == 1; },
+                        &*server, {}));
+  Client client{"localhost", portString};
+  ASSERT_TRUE(connectClients({&client}));
+
+  // The new client may occupy the old one's slot, but not its identity.
+  const Connection stale = connects[0];
+  server->send({Message{stale, "for the old client"}});
+  server->broadcast("everyone", std::span{&stale, 1});
+  server->disconnect(stale);
+  EXPECT_EQ(disconnects.size(), 1u);
+
+  server->send({Message{connects[1], "for the new client"}});
+  std::string got;
+  ASSERT_TRUE(pumpUntil(
+      [&] {
+        got += client.receive();
+        return !got.empty();
+      },
+      &*server, {&client}));
+  EXPECT_EQ(got, "for the new client");
+  EXPECT_FALSE(client.isDisconnected());
+}
+
 TEST_F(EndToEnd, NoDisconnectCallbacksDuringServerDestruction) {
   Client client{"localhost", portString};
   ASSERT_TRUE(connectClients({&client}));
@@ -0,0 +1,85 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <poll.h>
+
+#include <deque>
+#include <optional>
+#include <string>
+#include <vector>
+
+using networking::Client;
+using networking::ClientOptions;
+using networking::Connection;
+using networking::Message;
+using networking::Server;
+using networking::ServerOptions;
+using testhelpers::pumpUntil;
+
+namespace {
+
+// Waits on a native handle the way an external event loop would.
+bool readable(int handle, int timeoutMs) {
+  pollfd entry{handle, POLLIN, 0};
+  return ::poll(&entry, 1, timeoutMs) == 1 && (entry.revents & POLLIN);
+}
+
+TEST(EventLoop, InlineServerAndClientHaveNoHandle) {
+  Server server{0, "", [](Connection) { }, [](Connection) { }};
+  Client client{"localhost", std::to_string(server.getPort())};
+  EXPECT_EQ(server.nativeHandle(), -1);
+  EXPECT_EQ(client.nativeHandle(), -1);
+}
+
+TEST(EventLoop, HandlesSignalWorkForUpdate) {
+  std::vector<Connection> connects;
+  ServerOptions serverOptions;
+  serverOptions.ioThreads = 2;
+  Server server{0, "", [&](Connection c) { connects.push_back(c); },
+                [](Connection) { }, serverOptions};
+  ClientOptions clientOptions;
+  clientOptions.ioThread = true;
+  Client client{"localhost", std::to_string(server.getPort()), clientOptions};
+  ASSERT_GE(server.nativeHandle(), 0);
+  ASSERT_GE(client.nativeHandle(), 0);
+
+  // The connect itself is work for the server.
+  ASSERT_TRUE(readable(server.nativeHandle(), 5000));
+  server.update();
+  ASSERT_EQ(connects.size(), 1u);
+  EXPECT_FALSE(readable(server.nativeHandle(), 0));
+
+  client.send("ping");
+  std::deque<Message> received;
+  while (received.empty() && readable(server.nativeHandle(), 5000)) {
+    server.update();
+    received = server.receive();
+  }
+  ASSERT_EQ(received.size(), 1u);
+  EXPECT_EQ(received.front().text, "ping");
+
+  server.send({Message{connects.front(), "pong"}});
+  ASSERT_TRUE(readable(client.nativeHandle(), 5000));
+  client.update();
+  EXPECT_FALSE(readable(client.nativeHandle(), 0));
+  EXPECT_EQ(client.receive(), "pong");
+}
+
+TEST(EventLoop, ThreadedClientObservesServerDisconnect) {
+  std::vector<Connection> connects;
+  Server server{0, "", [&](Connection c) { connects.push_back(c); },
+                [](Connection) { }};
+  ClientOptions clientOptions;
+  clientOptions.ioThread = true;
+  Client client{"localhost", std::to_string(server.getPort()), clientOptions};
+  ASSERT_TRUE(pumpUntil([&] { return !connects.empty(); }, &server, {}));
+
+  // Only the server is pumped; the handle alone tells the client to look.
+  server.disconnect(connects.front());
+  EXPECT_TRUE(pumpUntil([&] { return readable(client.nativeHandle(), 0); },
+                        &server, {}));
+  EXPECT_TRUE(client.isDisconnected());
+}
+
+}  // namespace
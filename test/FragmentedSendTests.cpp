@@ -0,0 +1,217 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+using networking::ClientOptions;
+using networking::Connection;
+using networking::Message;
+using networking::Server;
+using networking::ServerOptions;
+using testhelpers::ServerAndClient;
+using testhelpers::connectTcp;
+using testhelpers::pumpUntil;
+
+namespace {
+
+class FragmentedSend : public ServerAndClient { };
+
+std::vector<std::byte>
+pattern(size_t size) {
+  std::vector<std::byte> bytes(size);
+  for (size_t i = 0; i < size; ++i) {
+    bytes[i] = static_cast<std::byte>(i * 31 % 251);
+  }
+  return bytes;
+}
+
+// What a raw websocket peer saw of one large message before the Server's
+// close frame.
+struct CloseDuringSend {
+  bool closed = false;
+  bool messageDone = false;
+  size_t payloadBytes = 0;
+};
+
+// Sends a `size` byte message to a raw websocket peer that closes the
+// connection as soon as the first bytes of it arrive, then reads everything
+// up to the Server's close frame. The peer reads without Beast so that it
+// sees the frames as they are interleaved on the wire.
+CloseDuringSend
+closeDuringSend(size_t sendFragmentBytes, size_t size) {
+  ServerOptions options;
+  options.sendFragmentBytes = sendFragmentBytes;
+  std::vector<Connection> connects;
+  Server server{0, "",
+                [&](Connection c) { connects.push_back(c); },
+                [](Connection) { },
+                options};
+
+  const int fd = connectTcp(server.getPort());
+  const std::string upgrade =
+    "GET / HTTP/1.1\r\nHost: localhost\r\n"
+    "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n\r\n";
+  ::send(fd, upgrade.data(), upgrade.size(), 0);
+
+  std::string wire;
+  const auto readAvailable = [&] {
+    char buffer[64 * 1024];
+    ssize_t count;
+    while ((count = ::recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+      wire.append(buffer, static_cast<size_t>(count));
+    }
+  };
+  size_t headerEnd = std::string::npos;
+  pumpUntil([&] {
+    readAvailable();
+    headerEnd = wire.find("\r\n\r\n");
+    return headerEnd != std::string::npos && !connects.empty();
+  }, &server, {});
+  CloseDuringSend result;
+  if (headerEnd == std::string::npos || connects.empty()) {
+    ::close(fd);
+    return result;
+  }
+  wire.erase(0, headerEnd + 4);
+
+  server.send(std::deque<Message>{Message{connects.front(),
+                                          std::string(size, 'f')}});
+  pumpUntil([&] {
+    readAvailable();
+    return !wire.empty();
+  }, &server, {});
+
+  // A masked close frame with status 1000 and an all zero masking key.
+  const char close[] = {'\x88', '\x82', 0, 0, 0, 0, '\x03', '\xe8'};
+  ::send(fd, close, sizeof(close), 0);
+
+  // Server frames are unmasked: two header bytes and an optional 16 or 64
+  // bit length.
+  size_t offset = 0;
+  pumpUntil([&] {
+    readAvailable();
+    while (!result.closed && wire.size() - offset >= 2) {
+      const auto byte = [&](size_t i) {
+        return static_cast<uint8_t>(wire[offset + i]);
+      };
+      size_t header = 2;
+      uint64_t length = byte(1) & 0x7f;
+      if (length >= 126) {
+        const size_t lengthBytes = length == 126 ? 2 : 8;
+        if (wire.size() - offset < header + lengthBytes) {
+          break;
+        }
+        length = 0;
+        for (size_t i = 0; i < lengthBytes; ++i) {
+          length = (length << 8) | byte(header + i);
+        }
+        header += lengthBytes;
+      }
+      if (wire.size() - offset < header + length) {
+        break;
+      }
+      const uint8_t opcode = byte(0) & 0x0f;
+      if (opcode == 0x8) {
+        result.closed = true;
+      } else if (opcode < 0x8) {
+        result.payloadBytes += length;
+        result.messageDone = result.messageDone || (byte(0) & 0x80) != 0;
+      }
+      offset += header + length;
+    }
+    return result.closed;
+  }, &server, {}, 10'000);
+  ::close(fd);
+  return result;
+}
+
+TEST_F(FragmentedSend, LargeMessagesArriveWholeAndInOrder) {
+  ServerOptions options;
+  options.sendFragmentBytes = 1000;
+  start(options);
+
+  const auto large = pattern(100'000);
+  const auto small = pattern(10);
+  server->send(connects.front(), large);
+  server->send(connects.front(), small);
+
+  std::deque<std::vector<std::byte>> received;
+  ASSERT_TRUE(pumpUntil([&] {
+    auto batch = client->receiveBinary();
+    received.insert(received.end(), batch.begin(), batch.end());
+    return received.size() >= 2;
+  }, &*server, {&*client}));
+  ASSERT_EQ(received.size(), 2u);
+  EXPECT_EQ(received[0], large);
+  EXPECT_EQ(received[1], small);
+
+  const auto stats = server->stats();
+  EXPECT_EQ(stats.messagesOut, 2u);
+  EXPECT_EQ(stats.bytesOut, large.size() + small.size());
+}
+
+TEST_F(FragmentedSend, TextMaySplitInsideACharacter) {
+  ServerOptions options;
+  options.sendFragmentBytes = 1001;
+  start(options);
+
+  // Two byte characters, so every odd fragment boundary cuts one in half.
+  std::string payload;
+  while (payload.size() < 50'000) {
+    payload += "é";
+  }
+  server->send(std::deque<Message>{Message{connects.front(), payload}});
+  EXPECT_EQ(receiveAtLeast(payload.size()), payload);
+  EXPECT_TRUE(disconnects.empty());
+}
+
+TEST_F(FragmentedSend, CompressedMessagesSurviveFragmentation) {
+  ServerOptions options;
+  options.sendFragmentBytes = 512;
+  options.compression.enabled = true;
+  ClientOptions clientOptions;
+  clientOptions.compression.enabled = true;
+  start(options, clientOptions);
+
+  std::string payload;
+  for (int i = 0; payload.size() < 200'000; ++i) {
+    payload += "update " + std::to_string(i % 97) + ";";
+  }
+  server->send(std::deque<Message>{Message{connects.front(), payload}});
+  EXPECT_EQ(receiveAtLeast(payload.size()), payload);
+}
+
+TEST(FragmentedSendClose, ClosingPeersAreAnsweredBetweenFragments) {
+  const size_t size = 32 * 1024 * 1024;
+  const auto seen = closeDuringSend(64 * 1024, size);
+  EXPECT_TRUE(seen.closed);
+  EXPECT_FALSE(seen.messageDone);
+  EXPECT_LT(seen.payloadBytes, size);
+}
+
+TEST(FragmentedSendClose, WholeMessagesHoldTheCloseBack) {
+  const size_t size = 32 * 1024 * 1024;
+  const auto seen = closeDuringSend(0, size);
+  EXPECT_TRUE(seen.closed);
+  EXPECT_TRUE(seen.messageDone);
+  EXPECT_EQ(seen.payloadBytes, size);
+}
+
+TEST_F(FragmentedSend, ZeroWritesWholeMessages) {
+  ServerOptions options;
+  options.sendFragmentBytes = 0;
+  start(options);
+
+  const std::string payload(300'000, 'z');
+  server->send(std::deque<Message>{Message{connects.front(), payload}});
+  EXPECT_EQ(receiveAtLeast(payload.size()), payload);
+}
+
+}  // namespace
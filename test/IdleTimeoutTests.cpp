@@ -0,0 +1,104 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+using networking::ClientOptions;
+using networking::ServerOptions;
+using networking::TimeoutOptions;
+using testhelpers::ServerAndClient;
+using testhelpers::pumpUntil;
+
+using namespace std::chrono_literals;
+
+namespace {
+
+class IdleTimeout : public ServerAndClient {
+protected:
+  void start(TimeoutOptions timeouts, ClientOptions clientOptions = {}) {
+    ServerOptions options;
+    options.timeouts = timeouts;
+    ServerAndClient::start(options, clientOptions);
+  }
+
+  // Pumps both ends for the given time, or until the server reports a
+  // disconnect.
+  void pumpFor(std::chrono::milliseconds duration, bool pumpClient) {
+    const auto end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < end && disconnects.empty()) {
+      server->update();
+      if (pumpClient) {
+        client->update();
+      }
+      std::this_thread::sleep_for(1ms);
+    }
+  }
+};
+
+TEST_F(IdleTimeout, SilentConnectionsAreDisconnected) {
+  TimeoutOptions timeouts;
+  timeouts.idle = 100ms;
+  timeouts.keepAlivePings = false;
+  start(timeouts);
+
+  pumpFor(2s, true);
+  ASSERT_EQ(disconnects.size(), 1u);
+  EXPECT_EQ(disconnects.front(), connects.front());
+  EXPECT_TRUE(pumpUntil([&] { return client->isDisconnected(); },
+                        &*server, {&*client}));
+}
+
+TEST_F(IdleTimeout, PingsKeepResponsivePeersConnected) {
+  TimeoutOptions timeouts;
+  timeouts.idle = 100ms;
+  start(timeouts);
+
+  pumpFor(600ms, true);
+  EXPECT_TRUE(disconnects.empty());
+  EXPECT_FALSE(client->isDisconnected());
+}
+
+TEST_F(IdleTimeout, PeersThatStopAnsweringAreDisconnected) {
+  TimeoutOptions timeouts;
+  timeouts.idle = 100ms;
+  start(timeouts);
+
+  // An inline client that is never updated cannot answer pings, just like a
+  // phone that dropped off the network.
+  pumpFor(2s, false);
+  EXPECT_EQ(disconnects.size(), 1u);
+}
+
+TEST_F(IdleTimeout, ActiveClientsStayConnectedWithoutPings) {
+  TimeoutOptions timeouts;
+  timeouts.idle = 100ms;
+  timeouts.keepAlivePings = false;
+  start(timeouts);
+
+  const auto end = std::chrono::steady_clock::now() + 600ms;
+  while (std::chrono::steady_clock::now() < end) {
+    client->send("still here");
+    server->update();
+    client->update();
+    server->recycle(server->receive());
+    std::this_thread::sleep_for(5ms);
+  }
+  EXPECT_TRUE(disconnects.empty());
+}
+
+TEST_F(IdleTimeout, ClientGivesUpOnASilentServer) {
+  ClientOptions clientOptions;
+  clientOptions.timeouts.idle = 100ms;
+  clientOptions.timeouts.keepAlivePings = false;
+  start({}, clientOptions);
+
+  EXPECT_TRUE(pumpUntil([&] { return client->isDisconnected(); },
+                        &*server, {&*client}));
+  EXPECT_TRUE(pumpUntil([&] { return disconnects.size() == 1; },
+                        &*server, {&*client}));
+}
+
+}  // namespace
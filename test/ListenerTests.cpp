@@ -0,0 +1,171 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+using networking::Client;
+using networking::ClientOptions;
+using networking::Connection;
+using networking::Message;
+using networking::Server;
+using networking::ServerOptions;
+using testhelpers::connectTcp;
+using testhelpers::connectTcp6;
+using testhelpers::connectUnix;
+using testhelpers::httpExchangeOver;
+using testhelpers::pumpUntil;
+
+namespace {
+
+const std::string CLOSE_REQUEST =
+  "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+
+bool hasIPv6Loopback() {
+  const int fd = connectTcp6(0);
+  // Nothing listens on port 0, so any error but a refusal means there is
+  // no usable ::1.
+  const bool refused = fd < 0 && errno == ECONNREFUSED;
+  if (fd >= 0) {
+    ::close(fd);
+  }
+  return refused;
+}
+
+class UnixSocket : public ::testing::Test {
+protected:
+  void SetUp() override {
+    const auto* info = ::testing::UnitTest::GetInstance()->current_test_info();
+    path = std::filesystem::temp_directory_path()
+         / (std::string{"networking-"} + info->name() + ".sock");
+    std::filesystem::remove(path);
+  }
+
+  void TearDown() override {
+    server.reset();
+    std::filesystem::remove(path);
+  }
+
+  void start() {
+    ServerOptions options;
+    options.unixSocket = path;
+    server.emplace(0, "<html>local</html>",
+                   [this](Connection c) { connects.push_back(c); },
+                   [](Connection) { },
+                   options);
+  }
+
+  std::filesystem::path path;
+  std::optional<Server> server;
+  std::vector<Connection> connects;
+};
+
+TEST_F(UnixSocket, ClientsExchangeMessagesOverThePath) {
+  start();
+  ClientOptions options;
+  options.unixSocket = path;
+  Client client{"localhost", "", options};
+  ASSERT_TRUE(pumpUntil([&] { return connects.size() == 1; },
+                        &*server, {&client}));
+
+  client.send("over a pipe");
+  std::deque<Message> received;
+  ASSERT_TRUE(pumpUntil([&] {
+    auto batch = server->receive();
+    received.insert(received.end(), batch.begin(), batch.end());
+    return !received.empty();
+  }, &*server, {&client}));
+  EXPECT_EQ(received.front().text, "over a pipe");
+
+  server->send(std::deque<Message>{Message{connects.front(), "and back"}});
+  std::string got;
+  ASSERT_TRUE(pumpUntil([&] {
+    got += client.receive();
+    return !got.empty();
+  }, &*server, {&client}));
+  EXPECT_EQ(got, "and back");
+}
+
+TEST_F(UnixSocket, PathAndPortServeTheSamePage) {
+  start();
+  const std::string local =
+    httpExchangeOver(*server, connectUnix(path.string()), CLOSE_REQUEST);
+  const std::string tcp =
+    httpExchangeOver(*server, connectTcp(server->getPort()), CLOSE_REQUEST);
+  EXPECT_NE(local.find("<html>local</html>"), std::string::npos);
+  EXPECT_EQ(local, tcp);
+  EXPECT_EQ(server->stats().acceptedConnections, 2u);
+}
+
+TEST_F(UnixSocket, StaleSocketFileIsReplacedAndRemoved) {
+  start();
+  server.reset();
+  EXPECT_FALSE(std::filesystem::exists(path));
+
+  // A socket file left behind by a crash would otherwise block the bind.
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  const std::string name = path.string();
+  std::copy(name.begin(), name.end(), address.sun_path);
+  ASSERT_EQ(::bind(fd, reinterpret_cast<const sockaddr*>(&address),
+                   sizeof(address)), 0);
+  ::close(fd);
+  ASSERT_TRUE(std::filesystem::is_socket(path));
+
+  start();
+  EXPECT_NE(httpExchangeOver(*server, connectUnix(name), CLOSE_REQUEST)
+              .find("200 OK"),
+            std::string::npos);
+}
+
+TEST_F(UnixSocket, ASecondServerOnALivePathFails) {
+  start();
+  ServerOptions options;
+  options.unixSocket = path;
+  EXPECT_ANY_THROW((Server{0, "", [](Connection) { }, [](Connection) { },
+                           options}));
+
+  ASSERT_TRUE(std::filesystem::is_socket(path));
+  EXPECT_NE(httpExchangeOver(*server, connectUnix(path.string()),
+                             CLOSE_REQUEST).find("200 OK"),
+            std::string::npos);
+}
+
+TEST_F(UnixSocket, AFileThatReplacedTheSocketIsNotRemoved) {
+  start();
+  std::filesystem::remove(path);
+  std::ofstream{path} << "someone else's";
+  server.reset();
+  EXPECT_TRUE(std::filesystem::is_regular_file(path));
+}
+
+TEST_F(UnixSocket, OtherFilesAtThePathAreLeftAlone) {
+  std::ofstream{path} << "not a socket";
+  EXPECT_ANY_THROW(start());
+  EXPECT_TRUE(std::filesystem::is_regular_file(path));
+}
+
+TEST(DualStack, ServesIPv4AndIPv6OnOnePort) {
+  if (!hasIPv6Loopback()) {
+    GTEST_SKIP() << "IPv6 loopback is unavailable";
+  }
+  ServerOptions options;
+  options.dualStack = true;
+  Server server{0, "<html>both</html>",
+                [](Connection) { }, [](Connection) { }, options};
+
+  const std::string v4 =
+    httpExchangeOver(server, connectTcp(server.getPort()), CLOSE_REQUEST);
+  const std::string v6 =
+    httpExchangeOver(server, connectTcp6(server.getPort()), CLOSE_REQUEST);
+  EXPECT_NE(v4.find("<html>both</html>"), std::string::npos);
+  EXPECT_NE(v6.find("<html>both</html>"), std::string::npos);
+}
+
+}  // namespace
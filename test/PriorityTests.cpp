@@ -0,0 +1,109 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <deque>
+#include <span>
+#include <string>
+
+using networking::Connection;
+using networking::Message;
+using networking::MessageType;
+using networking::OutboundLimits;
+using networking::OverflowPolicy;
+using networking::Priority;
+using networking::ServerOptions;
+using testhelpers::ServerAndClient;
+
+namespace {
+
+// Everything sent between two update()s is ordered by the lanes alone.
+class Priorities : public ServerAndClient {
+protected:
+  void queue(const std::string& text, Priority priority) {
+    Message message{connects.front(), text + ";"};
+    message.priority = priority;
+    server->send(std::deque<Message>{message});
+  }
+};
+
+TEST_F(Priorities, RealtimeOvertakesEverythingQueued) {
+  start({});
+  queue("b0", Priority::Bulk);
+  queue("n0", Priority::Normal);
+  queue("b1", Priority::Bulk);
+  queue("r0", Priority::Realtime);
+  queue("r1", Priority::Realtime);
+  EXPECT_EQ(receiveAtLeast(15), "r0;r1;n0;b0;b1;");
+}
+
+TEST_F(Priorities, BulkGetsATurnBetweenNormalMessages) {
+  ServerOptions options;
+  options.normalPerBulk = 2;
+  start(options);
+  for (int i = 0; i < 3; ++i) {
+    queue("b" + std::to_string(i), Priority::Bulk);
+  }
+  for (int i = 0; i < 5; ++i) {
+    queue("n" + std::to_string(i), Priority::Normal);
+  }
+  EXPECT_EQ(receiveAtLeast(24), "n0;n1;b0;n2;n3;b1;n4;b2;");
+}
+
+TEST_F(Priorities, ZeroWeightIsStrictPriority) {
+  ServerOptions options;
+  options.normalPerBulk = 0;
+  start(options);
+  queue("b0", Priority::Bulk);
+  for (int i = 0; i < 5; ++i) {
+    queue("n" + std::to_string(i), Priority::Normal);
+  }
+  EXPECT_EQ(receiveAtLeast(18), "n0;n1;n2;n3;n4;b0;");
+}
+
+TEST_F(Priorities, BroadcastsTakeAPriority) {
+  start({});
+  server->broadcast("b;", std::span<const Connection>{connects},
+                    MessageType::Text, Priority::Bulk);
+  server->broadcast("r;", MessageType::Text, Priority::Realtime);
+  EXPECT_EQ(receiveAtLeast(4), "r;b;");
+}
+
+TEST_F(Priorities, OverflowDropsBulkFirst) {
+  ServerOptions options;
+  options.outboundLimits = OutboundLimits{.maxQueuedMessages = 3,
+                                          .policy = OverflowPolicy::DropOldest};
+  start(options);
+  queue("b0", Priority::Bulk);
+  queue("b1", Priority::Bulk);
+  queue("r0", Priority::Realtime);
+  queue("n0", Priority::Normal);
+  EXPECT_EQ(server->queueDepth(connects.front()).messages, 3u);
+  EXPECT_EQ(receiveAtLeast(9), "r0;n0;b1;");
+}
+
+TEST_F(Priorities, DropNewestDiscardsTheNewestBulkMessage) {
+  ServerOptions options;
+  options.outboundLimits = OutboundLimits{.maxQueuedMessages = 2,
+                                          .policy = OverflowPolicy::DropNewest};
+  start(options);
+  queue("b0", Priority::Bulk);
+  queue("b1", Priority::Bulk);
+  queue("r0", Priority::Realtime);
+  EXPECT_EQ(receiveAtLeast(6), "r0;b0;");
+}
+
+TEST_F(Priorities, DropNewestMakesRoomForALargeRealtimeMessage) {
+  ServerOptions options;
+  options.outboundLimits = OutboundLimits{.maxQueuedBytes = 12,
+                                          .policy = OverflowPolicy::DropNewest};
+  start(options);
+  queue("b0", Priority::Bulk);
+  queue("b1", Priority::Bulk);
+  queue("b2", Priority::Bulk);
+  queue("realtime", Priority::Realtime);
+  EXPECT_EQ(server->queueDepth(connects.front()).bytes, 12u);
+  EXPECT_EQ(receiveAtLeast(12), "realtime;b0;");
+}
+
+}  // namespace
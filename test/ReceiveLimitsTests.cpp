@@ -0,0 +1,149 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+using networking::ClientOptions;
+using networking::Message;
+using networking::MessageType;
+using networking::ServerOptions;
+using testhelpers::ServerAndClient;
+using testhelpers::pumpUntil;
+
+namespace {
+
+class ReceiveLimits : public ServerAndClient {
+protected:
+  // Collects received Messages until `done` holds for them.
+  template <typename Predicate>
+  bool receiveUntil(Predicate&& done) {
+    return pumpUntil([&] {
+      auto batch = server->receive();
+      received.insert(received.end(), batch.begin(), batch.end());
+      return done();
+    }, &*server, {&*client});
+  }
+
+  std::deque<Message> received;
+};
+
+TEST_F(ReceiveLimits, MessagesUpToTheLimitArrive) {
+  ServerOptions options;
+  options.receive.maxMessageBytes = 1024;
+  start(options);
+
+  client->send(std::string(1024, 'a'));
+  ASSERT_TRUE(receiveUntil([&] { return !received.empty(); }));
+  EXPECT_EQ(received.front().text.size(), 1024u);
+  EXPECT_TRUE(received.front().endOfMessage);
+  EXPECT_TRUE(disconnects.empty());
+}
+
+TEST_F(ReceiveLimits, OversizedMessagesDisconnectTheSender) {
+  ServerOptions options;
+  options.receive.maxMessageBytes = 1024;
+  start(options);
+
+  client->send(std::string(4096, 'a'));
+  EXPECT_TRUE(pumpUntil([&] { return disconnects.size() == 1; },
+                        &*server, {&*client}));
+  EXPECT_TRUE(pumpUntil([&] { return client->isDisconnected(); },
+                        &*server, {&*client}));
+  EXPECT_TRUE(server->receive().empty());
+}
+
+TEST_F(ReceiveLimits, StreamingDeliversBoundedFragmentsInOrder) {
+  ServerOptions options;
+  options.receive.streaming = true;
+  options.receive.fragmentBytes = 1000;
+  start(options);
+
+  std::string payload;
+  for (int i = 0; payload.size() < 10000; ++i) {
+    payload += std::to_string(i) + ",";
+  }
+  client->send(payload);
+  client->send("short");
+
+  ASSERT_TRUE(receiveUntil([&] {
+    return !received.empty() && received.back().text == "short";
+  }));
+  ASSERT_GE(received.size(), 11u);
+
+  std::string joined;
+  for (size_t i = 0; i + 1 < received.size(); ++i) {
+    const Message& fragment = received[i];
+    EXPECT_LE(fragment.text.size(), 1000u);
+    EXPECT_EQ(fragment.type, MessageType::Text);
+    EXPECT_EQ(fragment.endOfMessage, i + 2 == received.size());
+    joined += fragment.text;
+  }
+  EXPECT_EQ(joined, payload);
+  EXPECT_TRUE(received.back().endOfMessage);
+  EXPECT_EQ(server->stats().messagesIn, 2u);
+}
+
+TEST_F(ReceiveLimits, StreamingStillEnforcesTheLimit) {
+  ServerOptions options;
+  options.receive.streaming = true;
+  options.receive.fragmentBytes = 512;
+  options.receive.maxMessageBytes = 2048;
+  start(options);
+
+  client->send(std::string(8192, 'b'));
+  EXPECT_TRUE(pumpUntil([&] { return disconnects.size() == 1; },
+                        &*server, {&*client}));
+}
+
+TEST_F(ReceiveLimits, ReadingPausesWhileTheApplicationDoesNotDrain) {
+  ServerOptions options;
+  options.receive.streaming = true;
+  options.receive.fragmentBytes = 4096;
+  options.receive.maxUndeliveredBytes = 16 * 1024;
+  start(options);
+
+  std::string payload;
+  for (int i = 0; payload.size() < 1024 * 1024; ++i) {
+    payload += std::to_string(i) + ",";
+  }
+  client->send(payload);
+
+  // Nothing is received here, so the Server stops reading at the limit.
+  ASSERT_TRUE(pumpUntil([&] { return server->stats().bytesIn >= 16 * 1024; },
+                        &*server, {&*client}));
+  pumpUntil([] { return false; }, &*server, {&*client}, 100);
+  EXPECT_LT(server->stats().bytesIn, 16 * 1024 + 4096);
+
+  std::string joined;
+  ASSERT_TRUE(receiveUntil([&] {
+    for (; !received.empty(); received.pop_front()) {
+      joined += received.front().text;
+    }
+    return joined.size() >= payload.size();
+  }));
+  EXPECT_EQ(joined, payload);
+  EXPECT_TRUE(disconnects.empty());
+}
+
+TEST_F(ReceiveLimits, ZeroFragmentBytesAreRejected) {
+  ServerOptions options;
+  options.receive.streaming = true;
+  options.receive.fragmentBytes = 0;
+  EXPECT_THROW(start(options), std::runtime_error);
+}
+
+TEST_F(ReceiveLimits, ClientsEnforceTheirOwnLimit) {
+  ClientOptions clientOptions;
+  clientOptions.maxMessageBytes = 1024;
+  start({}, clientOptions);
+
+  server->send(std::deque<Message>{
+    Message{connects.front(), std::string(4096, 'c')}});
+  EXPECT_TRUE(pumpUntil([&] { return client->isDisconnected(); },
+                        &*server, {&*client}));
+}
+
+}  // namespace
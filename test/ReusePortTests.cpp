@@ -0,0 +1,83 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using networking::Client;
+using networking::Connection;
+using networking::Server;
+using networking::ServerOptions;
+
+namespace {
+
+// Two Servers in one process listening on one port, as separate processes
+// or threads would. Both are pumped from the test thread.
+class ReusePort : public ::testing::Test {
+protected:
+  ReusePort() {
+    ServerOptions options;
+    options.reusePort = true;
+    first.emplace(0, "<html>first</html>",
+                  [this](Connection) { ++firstConnects; },
+                  [](Connection) { },
+                  options);
+    second.emplace(first->getPort(), "<html>second</html>",
+                   [this](Connection) { ++secondConnects; },
+                   [](Connection) { },
+                   options);
+  }
+
+  bool pumpUntilConnected(size_t count) {
+    for (int i = 0; i < 2000; ++i) {
+      if (firstConnects + secondConnects >= count) {
+        return true;
+      }
+      first->update();
+      second->update();
+      for (auto& client : clients) {
+        client->update();
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+  }
+
+  std::optional<Server> first;
+  std::optional<Server> second;
+  std::vector<std::unique_ptr<Client>> clients;
+  size_t firstConnects = 0;
+  size_t secondConnects = 0;
+};
+
+TEST_F(ReusePort, ServersShareThePort) {
+  EXPECT_EQ(first->getPort(), second->getPort());
+}
+
+TEST_F(ReusePort, ConnectionsAreSpreadAcrossServers) {
+  const std::string port = std::to_string(first->getPort());
+  constexpr size_t COUNT = 32;
+  for (size_t i = 0; i < COUNT; ++i) {
+    clients.push_back(std::make_unique<Client>("localhost", port));
+  }
+  ASSERT_TRUE(pumpUntilConnected(COUNT));
+
+  EXPECT_EQ(firstConnects + secondConnects, COUNT);
+  EXPECT_GT(firstConnects, 0u);
+  EXPECT_GT(secondConnects, 0u);
+  EXPECT_EQ(first->stats().acceptedConnections, firstConnects);
+  EXPECT_EQ(second->stats().acceptedConnections, secondConnects);
+}
+
+TEST(ReusePortOff, SecondServerCannotBind) {
+  Server first{0, "", [](Connection) { }, [](Connection) { }};
+  EXPECT_ANY_THROW(Server(first.getPort(), "",
+                          [](Connection) { }, [](Connection) { }));
+}
+
+}  // namespace
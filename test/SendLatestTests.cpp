@@ -0,0 +1,85 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <deque>
+#include <string>
+
+using networking::Client;
+using networking::Connection;
+using networking::Message;
+using networking::MessageType;
+using networking::Priority;
+using testhelpers::ServerAndClient;
+using testhelpers::pumpUntil;
+
+namespace {
+
+class SendLatest : public ServerAndClient { };
+
+TEST_F(SendLatest, ReplacesTheQueuedValueInPlace) {
+  start({});
+  const Connection c = connects.front();
+  server->sendLatest(c, 1, "a1;");
+  server->send(std::deque<Message>{Message{c, "x;"}});
+  server->sendLatest(c, 1, "a2;");
+  server->sendLatest(c, 2, "b1;");
+  server->sendLatest(c, 1, "a3;");
+  EXPECT_EQ(server->queueDepth(c).messages, 3u);
+  EXPECT_EQ(receiveAtLeast(9), "a3;x;b1;");
+  EXPECT_EQ(server->stats().supersededMessages, 2u);
+}
+
+TEST_F(SendLatest, BacklogIsBoundedByTheNumberOfKeys) {
+  start({});
+  const Connection c = connects.front();
+  for (int tick = 0; tick < 100; ++tick) {
+    for (uint64_t entity = 0; entity < 4; ++entity) {
+      server->sendLatest(c, entity, std::to_string(entity) + "@"
+                                    + std::to_string(tick) + ";");
+    }
+  }
+  EXPECT_EQ(server->queueDepth(c).messages, 4u);
+  EXPECT_EQ(receiveAtLeast(24), "0@99;1@99;2@99;3@99;");
+}
+
+TEST_F(SendLatest, ValuesSentAfterAWriteAreQueuedAgain) {
+  start({});
+  const Connection c = connects.front();
+  server->sendLatest(c, 7, "first;");
+  EXPECT_EQ(receiveAtLeast(6), "first;");
+  server->sendLatest(c, 7, "second;");
+  EXPECT_EQ(receiveAtLeast(7), "second;");
+  EXPECT_EQ(server->stats().supersededMessages, 0u);
+}
+
+TEST_F(SendLatest, KeepsThePriorityOfTheReplacedMessage) {
+  start({});
+  const Connection c = connects.front();
+  server->sendLatest(c, 1, "old;", MessageType::Text, Priority::Realtime);
+  server->send(std::deque<Message>{Message{c, "n;"}});
+  server->sendLatest(c, 1, "new;", MessageType::Text, Priority::Bulk);
+  EXPECT_EQ(receiveAtLeast(6), "new;n;");
+}
+
+TEST_F(SendLatest, KeysAreSeparatePerConnection) {
+  start({});
+  Client other{"localhost", std::to_string(server->getPort())};
+  ASSERT_TRUE(pumpUntil([&] { return connects.size() == 2; },
+                        &*server, {&*client, &other}));
+
+  // The fixture's Client was registered first.
+  server->sendLatest(connects[0], 1, "a;");
+  server->sendLatest(connects[1], 1, "b;");
+  std::string first;
+  std::string second;
+  ASSERT_TRUE(pumpUntil([&] {
+    first += client->receive();
+    second += other.receive();
+    return first.size() >= 2 && second.size() >= 2;
+  }, &*server, {&*client, &other}));
+  EXPECT_EQ(first, "a;");
+  EXPECT_EQ(second, "b;");
+}
+
+}  // namespace
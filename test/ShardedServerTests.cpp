@@ -0,0 +1,186 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+using networking::Client;
+using networking::Connection;
+using networking::Message;
+using networking::Server;
+using networking::ServerOptions;
+using testhelpers::pumpUntil;
+
+namespace {
+
+// Runs the server's I/O on background shards. Everything the tests observe
+// still goes through update() on the test thread.
+class Sharded : public ::testing::TestWithParam<unsigned> {
+protected:
+  Sharded() {
+    server.emplace(0, "<html>sharded</html>",
+                   [this](Connection c) { connects.push_back(c); },
+                   [this](Connection c) { disconnects.push_back(c); },
+                   ServerOptions{.ioThreads = GetParam()});
+    portString = std::to_string(server->getPort());
+  }
+
+  std::vector<Client*> raw() {
+    std::vector<Client*> result;
+    for (auto& client : clients) {
+      result.push_back(client.get());
+    }
+    return result;
+  }
+
+  bool connectClients(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      clients.push_back(std::make_unique<Client>("localhost", portString));
+    }
+    const size_t target = clients.size();
+    return pumpUntil([&] { return connects.size() >= target; },
+                     &*server, raw());
+  }
+
+  std::string portString;
+  std::optional<Server> server;
+  std::vector<std::unique_ptr<Client>> clients;
+  std::vector<Connection> connects;
+  std::vector<Connection> disconnects;
+};
+
+TEST_P(Sharded, EveryClientConnectsWithADistinctId) {
+  ASSERT_TRUE(connectClients(8));
+  auto sorted = connects;
+  std::sort(sorted.begin(), sorted.end(),
+            [](Connection a, Connection b) { return a.id < b.id; });
+  EXPECT_EQ(std::adjacent_find(sorted.begin(), sorted.end()), sorted.end());
+}
+
+TEST_P(Sharded, MessagesArePerConnectionFifoAcrossShards) {
+  ASSERT_TRUE(connectClients(6));
+  for (size_t i = 0; i < clients.size(); ++i) {
+    for (int seq = 0; seq < 10; ++seq) {
+      clients[i]->send(std::to_string(i) + ":" + std::to_string(seq));
+    }
+  }
+
+  std::deque<Message> received;
+  ASSERT_TRUE(pumpUntil(
+      [&] {
+        auto batch = server->receive();
+        received.insert(received.end(), batch.begin(), batch.end());
+        return received.size() >= 60;
+      },
+      &*server, raw()));
+  ASSERT_EQ(received.size(), 60u);
+
+  // Every connection's messages arrive in the order that client sent them.
+  for (auto connection : connects) {
+    std::vector<std::string> texts;
+    for (const auto& message : received) {
+      if (message.connection == connection) {
+        texts.push_back(message.text);
+      }
+    }
+    ASSERT_EQ(texts.size(), 10u);
+    const std::string prefix = texts.front().substr(0, texts.front().find(':'));
+    for (int seq = 0; seq < 10; ++seq) {
+      EXPECT_EQ(texts[static_cast<size_t>(seq)],
+                prefix + ":" + std::to_string(seq));
+    }
+  }
+}
+
+TEST_P(Sharded, SendAndBroadcastReachClientsOnEveryShard) {
+  ASSERT_TRUE(connectClients(5));
+  std::deque<Message> direct;
+  for (auto connection : connects) {
+    direct.push_back({connection, "direct;"});
+  }
+  server->send(direct);
+  server->broadcast("all;");
+
+  std::vector<std::string> got(clients.size());
+  ASSERT_TRUE(pumpUntil(
+      [&] {
+        bool done = true;
+        for (size_t i = 0; i < clients.size(); ++i) {
+          got[i] += clients[i]->receive();
+          done = done && got[i].size() == 11;
+        }
+        return done;
+      },
+      &*server, raw()));
+  for (const auto& text : got) {
+    EXPECT_EQ(text, "direct;all;");
+  }
+}
+
+TEST_P(Sharded, ServerAndClientDisconnectsAreReportedOnce) {
+  // Connect one at a time so that connects[i] belongs to clients[i].
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(connectClients(1));
+  }
+  server->disconnect(connects[0]);
+  ASSERT_EQ(disconnects.size(), 1u);
+  clients[1].reset();
+
+  ASSERT_TRUE(pumpUntil([&] { return disconnects.size() >= 2; },
+                        &*server, raw()));
+  // Let the shard finish the explicit disconnect as well; it must not be
+  // reported a second time.
+  pumpUntil([] { return false; }, &*server, raw(), 50);
+  EXPECT_EQ(disconnects.size(), 2u);
+  EXPECT_TRUE(pumpUntil([&] { return clients[0]->isDisconnected(); },
+                        &*server, raw()));
+}
+
+TEST_P(Sharded, TimedUpdateWakesForShardEvents) {
+  using namespace std::chrono_literals;
+  ASSERT_TRUE(connectClients(1));
+  clients.front()->send("wake up");
+  clients.front()->update();
+
+  const auto start = std::chrono::steady_clock::now();
+  std::deque<Message> received;
+  while (received.empty() && std::chrono::steady_clock::now() - start < 10s) {
+    server->update(5s);
+    received = server->receive();
+    clients.front()->update();
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start, 2s);
+  ASSERT_EQ(received.size(), 1u);
+  EXPECT_EQ(received.front().text, "wake up");
+}
+
+TEST_P(Sharded, HttpIsServedFromTheShards) {
+  const std::string response = testhelpers::httpExchange(
+      *server, server->getPort(),
+      "GET /index.html HTTP/1.1\r\nHost: localhost\r\n"
+      "Connection: close\r\n\r\n");
+  EXPECT_NE(response.find("<html>sharded</html>"), std::string::npos);
+}
+
+TEST_P(Sharded, DestroyedWithTrafficInFlight) {
+  ASSERT_TRUE(connectClients(6));
+  for (size_t i = 0; i < clients.size(); ++i) {
+    clients[i]->send("in flight");
+    clients[i]->update();
+  }
+  server->broadcast("queued at teardown");
+  // No callbacks may fire while the shards are being torn down.
+  const size_t before = disconnects.size();
+  server.reset();
+  EXPECT_EQ(disconnects.size(), before);
+}
+
+INSTANTIATE_TEST_SUITE_P(IoThreads, Sharded, ::testing::Values(1u, 2u, 4u));
+
+}  // namespace
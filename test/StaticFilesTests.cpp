@@ -0,0 +1,152 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <utility>
+
+using networking::Connection;
+using networking::Server;
+using networking::ServerOptions;
+using testhelpers::httpExchange;
+
+namespace {
+
+class StaticFiles : public ::testing::Test {
+protected:
+  void SetUp() override {
+    const auto* info = ::testing::UnitTest::GetInstance()->current_test_info();
+    root = std::filesystem::temp_directory_path()
+         / (std::string{"networking-static-"} + info->name());
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root / "assets");
+  }
+
+  void TearDown() override {
+    server.reset();
+    std::filesystem::remove_all(root);
+  }
+
+  void write(const std::filesystem::path& relative, const std::string& text) {
+    std::ofstream{root / relative, std::ios::binary} << text;
+  }
+
+  void start() {
+    ServerOptions options;
+    options.staticFiles.directory = root;
+    options.staticFiles.maxCachedFileBytes = 1024;
+    server.emplace(0, "<html>fallback</html>",
+                   [](Connection) { }, [](Connection) { },
+                   std::move(options));
+  }
+
+  std::string get(const std::string& target, const std::string& headers = "",
+                  const std::string& method = "GET") {
+    return httpExchange(*server, server->getPort(),
+                        method + " " + target + " HTTP/1.1\r\n"
+                        "Host: localhost\r\nConnection: close\r\n"
+                        + headers + "\r\n");
+  }
+
+  static std::string body(const std::string& response) {
+    const size_t end = response.find("\r\n\r\n");
+    return end == std::string::npos ? "" : response.substr(end + 4);
+  }
+
+  static std::string header(const std::string& response,
+                            const std::string& name) {
+    const size_t start = response.find("\r\n" + name + ": ");
+    if (start == std::string::npos) {
+      return "";
+    }
+    const size_t value = start + name.size() + 4;
+    return response.substr(value, response.find("\r\n", value) - value);
+  }
+
+  std::filesystem::path root;
+  std::optional<Server> server;
+};
+
+TEST_F(StaticFiles, ServesFilesWithTypeAndLength) {
+  write("assets/app.js", "console.log(1);");
+  write("assets/app.wasm", "wasm");
+  start();
+
+  const std::string script = get("/assets/app.js");
+  EXPECT_NE(script.find("200 OK"), std::string::npos);
+  EXPECT_EQ(header(script, "Content-Type"), "text/javascript; charset=utf-8");
+  EXPECT_EQ(header(script, "Content-Length"), "15");
+  EXPECT_EQ(body(script), "console.log(1);");
+
+  const std::string wasm = get("/assets/app.wasm?v=2");
+  EXPECT_EQ(header(wasm, "Content-Type"), "application/wasm");
+}
+
+TEST_F(StaticFiles, MatchingETagGetsNotModified) {
+  write("style.css", "body {}");
+  start();
+
+  const std::string first = get("/style.css");
+  const std::string etag = header(first, "ETag");
+  ASSERT_FALSE(etag.empty());
+
+  const std::string second =
+    get("/style.css", "If-None-Match: " + etag + "\r\n");
+  EXPECT_NE(second.find("304"), std::string::npos);
+  EXPECT_EQ(body(second), "");
+
+  const std::string stale = get("/style.css", "If-None-Match: \"other\"\r\n");
+  EXPECT_NE(stale.find("200 OK"), std::string::npos);
+  EXPECT_EQ(body(stale), "body {}");
+}
+
+TEST_F(StaticFiles, EditedFilesAreServedFresh) {
+  write("data.txt", "one");
+  start();
+  EXPECT_EQ(body(get("/data.txt")), "one");
+
+  write("data.txt", "second");
+  EXPECT_EQ(body(get("/data.txt")), "second");
+}
+
+TEST_F(StaticFiles, LargeFilesStreamFromDisk) {
+  std::string large;
+  for (int i = 0; large.size() < 600 * 1024; ++i) {
+    large += std::to_string(i) + ",";
+  }
+  write("large.bin", large);
+  start();
+
+  const std::string response = get("/large.bin");
+  EXPECT_EQ(header(response, "Content-Length"), std::to_string(large.size()));
+  EXPECT_EQ(header(response, "Content-Type"), "application/octet-stream");
+  EXPECT_TRUE(body(response) == large);
+
+  const std::string head = get("/large.bin", "", "HEAD");
+  EXPECT_EQ(header(head, "Content-Length"), std::to_string(large.size()));
+  EXPECT_EQ(body(head), "");
+}
+
+TEST_F(StaticFiles, MissingAndEscapingTargetsAreNotFound) {
+  write("assets/ok.txt", "ok");
+  start();
+  EXPECT_NE(get("/missing.txt").find("404"), std::string::npos);
+  EXPECT_NE(get("/assets/../../etc/passwd").find("404"), std::string::npos);
+  EXPECT_NE(get("/assets/%2e%2e/%2e%2e/etc/passwd").find("404"),
+            std::string::npos);
+}
+
+TEST_F(StaticFiles, IndexPrefersDirectoryThenHttpMessage) {
+  start();
+  EXPECT_EQ(body(get("/")), "<html>fallback</html>");
+
+  write("index.html", "<html>from disk</html>");
+  const std::string response = get("/");
+  EXPECT_EQ(body(response), "<html>from disk</html>");
+  EXPECT_EQ(header(response, "Content-Type"), "text/html; charset=utf-8");
+}
+
+}  // namespace
@@ -3,11 +3,17 @@
 #include "Client.h"
 #include "Server.h"
 
+#include "gtest/gtest.h"
+
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
+#include <optional>
 #include <string>
 #include <thread>
 #include <vector>
@@ -38,15 +44,50 @@ bool pumpUntil(Predicate&& done,
   return done();
 }
 
-// Send one raw HTTP request over a plain TCP socket and pump the server until
-// it closes the connection. Returns everything the server sent back. Uses
-// nonblocking reads so the single-threaded server can be pumped in between.
-inline std::string httpExchange(networking::Server& server,
-                                unsigned short port,
-                                const std::string& request) {
+// A Server on an ephemeral port with one Client connected to it, recording
+// every connect and disconnect. start() returns once the Client is
+// registered.
+//
+// With the default inline I/O, nothing is written until the next update(),
+// so whatever a test sends in between is queued as a whole. That makes the
+// order and contents of the queue deterministic.
+class ServerAndClient : public ::testing::Test {
+protected:
+  void start(networking::ServerOptions options,
+             networking::ClientOptions clientOptions = {}) {
+    server.emplace(0, "",
+                   [this](networking::Connection c) { connects.push_back(c); },
+                   [this](networking::Connection c) { disconnects.push_back(c); },
+                   options);
+    client.emplace("localhost", std::to_string(server->getPort()),
+                   clientOptions);
+    ASSERT_TRUE(pumpUntil([&] { return !connects.empty(); },
+                          &*server, {&*client}));
+  }
+
+  // Pumps both ends until the Client has received at least `size` bytes of
+  // text, and returns all of it.
+  std::string receiveAtLeast(size_t size) {
+    std::string got;
+    pumpUntil([&] {
+      got += client->receive();
+      return got.size() >= size;
+    }, &*server, {&*client});
+    return got;
+  }
+
+  std::optional<networking::Server> server;
+  std::optional<networking::Client> client;
+  std::vector<networking::Connection> connects;
+  std::vector<networking::Connection> disconnects;
+};
+
+// Open a plain TCP connection to the server on localhost. Returns -1 on
+// failure.
+inline int connectTcp(unsigned short port) {
   const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
   if (fd < 0) {
-    return {};
+    return -1;
   }
 
   sockaddr_in address{};
@@ -56,6 +97,60 @@ inline std::string httpExchange(networking::Server& server,
   if (::connect(fd, reinterpret_cast<const sockaddr*>(&address),
                 sizeof(address)) != 0) {
     ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+inline int connectTcp6(unsigned short port) {
+  const int fd = ::socket(AF_INET6, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  sockaddr_in6 address{};
+  address.sin6_family = AF_INET6;
+  address.sin6_port = htons(port);
+  address.sin6_addr = in6addr_loopback;
+  if (::connect(fd, reinterpret_cast<const sockaddr*>(&address),
+                sizeof(address)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+inline int connectUnix(const std::string& path) {
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    ::close(fd);
+    return -1;
+  }
+  std::copy(path.begin(), path.end(), address.sun_path);
+  if (::connect(fd, reinterpret_cast<const sockaddr*>(&address),
+                sizeof(address)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Send raw HTTP requests over a connected socket, which this takes over, and
+// pump the server until it closes the connection. Returns everything the
+// server sent back. Uses nonblocking reads so the single-threaded server can
+// be pumped in between. Connections are kept alive by default, so the last
+// request should carry "Connection: close" unless the test waits for the
+// idle timeout.
+inline std::string httpExchangeOver(networking::Server& server,
+                                    int fd,
+                                    const std::string& request) {
+  if (fd < 0) {
     return {};
   }
   ::send(fd, request.data(), request.size(), 0);
@@ -69,6 +164,8 @@ inline std::string httpExchange(networking::Server& server,
       response.append(buffer, static_cast<size_t>(count));
     } else if (count == 0) {
       break;  // Peer closed: the response is complete.
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      break;  // Reset, as when the server turned the connection away.
     }
     std::this_thread::sleep_for(std::chrono::milliseconds(1));
   }
@@ -76,4 +173,11 @@ inline std::string httpExchange(networking::Server& server,
   return response;
 }
 
+// httpExchangeOver() on a fresh TCP connection to the port.
+inline std::string httpExchange(networking::Server& server,
+                                unsigned short port,
+                                const std::string& request) {
+  return httpExchangeOver(server, connectTcp(port), request);
+}
+
 }  // namespace testhelpers
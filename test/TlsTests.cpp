@@ -0,0 +1,148 @@
+#include "TestHelpers.h"
+
+#include "gtest/gtest.h"
+
+#include <deque>
+#include <optional>
+#include <string>
+#include <vector>
+
+using networking::Client;
+using networking::ClientOptions;
+using networking::Connection;
+using networking::Message;
+using networking::Server;
+using networking::ServerOptions;
+using testhelpers::pumpUntil;
+
+namespace {
+
+const std::string CERTS_DIR = NETWORKING_TEST_CERTS_DIR;
+
+class Tls : public ::testing::Test {
+protected:
+  void start(bool sessionResumption = true) {
+    ServerOptions options;
+    options.tls.enabled = true;
+    options.tls.certificateChainFile = CERTS_DIR + "/localhost.crt";
+    options.tls.privateKeyFile = CERTS_DIR + "/localhost.key";
+    options.tls.sessionResumption = sessionResumption;
+    server.emplace(0, "<html>secure</html>",
+                   [this](Connection c) { connects.push_back(c); },
+                   [this](Connection) { ++disconnects; },
+                   options);
+    port = std::to_string(server->getPort());
+  }
+
+  static ClientOptions trusting() {
+    ClientOptions options;
+    options.tls.enabled = true;
+    options.tls.caFile = CERTS_DIR + "/localhost.crt";
+    return options;
+  }
+
+  // Connects a client, exchanges one message each way and disconnects it
+  // again. Returns false if any step did not happen.
+  bool roundTrip(ClientOptions options) {
+    const size_t expected = connects.size() + 1;
+    {
+      Client client{"localhost", port, options};
+      if (!pumpUntil([&] { return connects.size() == expected; },
+                     &*server, {&client})) {
+        return false;
+      }
+      client.send("ping");
+      std::deque<Message> received;
+      if (!pumpUntil([&] {
+            auto batch = server->receive();
+            received.insert(received.end(), batch.begin(), batch.end());
+            return !received.empty();
+          }, &*server, {&client})) {
+        return false;
+      }
+      server->send(std::deque<Message>{Message{connects.back(), "pong"}});
+      std::string reply;
+      if (!pumpUntil([&] {
+            reply += client.receive();
+            return !reply.empty();
+          }, &*server, {&client})
+          || reply != "pong" || received.front().text != "ping") {
+        return false;
+      }
+    }
+    return pumpUntil([&] { return disconnects == expected; },
+                     &*server, {});
+  }
+
+  std::optional<Server> server;
+  std::string port;
+  std::vector<Connection> connects;
+  size_t disconnects = 0;
+};
+
+TEST_F(Tls, ClientsExchangeMessagesOverTls) {
+  start();
+  ASSERT_TRUE(roundTrip(trusting()));
+  const auto stats = server->stats();
+  EXPECT_EQ(stats.tlsHandshakes, 1u);
+  EXPECT_EQ(stats.tlsHandshakeErrors, 0u);
+}
+
+TEST_F(Tls, ReconnectsResumeTheSession) {
+  start();
+  ASSERT_TRUE(roundTrip(trusting()));
+  ASSERT_TRUE(roundTrip(trusting()));
+  const auto stats = server->stats();
+  EXPECT_EQ(stats.tlsHandshakes, 2u);
+  EXPECT_EQ(stats.tlsResumedHandshakes, 1u);
+}
+
+TEST_F(Tls, ResumptionCanBeTurnedOff) {
+  start(false);
+  ASSERT_TRUE(roundTrip(trusting()));
+  ASSERT_TRUE(roundTrip(trusting()));
+  const auto stats = server->stats();
+  EXPECT_EQ(stats.tlsHandshakes, 2u);
+  EXPECT_EQ(stats.tlsResumedHandshakes, 0u);
+}
+
+TEST_F(Tls, UntrustedCertificatesAreRejected) {
+  start();
+  ClientOptions options;
+  options.tls.enabled = true;
+  Client client{"localhost", port, options};
+  EXPECT_TRUE(pumpUntil([&] { return client.isDisconnected(); },
+                        &*server, {&client}));
+  EXPECT_TRUE(connects.empty());
+}
+
+TEST_F(Tls, UnverifiedSessionsAreNotResumedByVerifyingClients) {
+  start();
+  ClientOptions unverified;
+  unverified.tls.enabled = true;
+  unverified.tls.verifyPeer = false;
+  ASSERT_TRUE(roundTrip(unverified));
+
+  // Resuming would skip the check that rejects the certificate.
+  ClientOptions untrusting;
+  untrusting.tls.enabled = true;
+  Client client{"localhost", port, untrusting};
+  EXPECT_TRUE(pumpUntil([&] { return client.isDisconnected(); },
+                        &*server, {&client}));
+  EXPECT_EQ(connects.size(), 1u);
+
+  ASSERT_TRUE(roundTrip(trusting()));
+  EXPECT_EQ(server->stats().tlsResumedHandshakes, 0u);
+}
+
+TEST_F(Tls, PlainClientsCannotConnect) {
+  start();
+  Client client{"localhost", port};
+  EXPECT_TRUE(pumpUntil([&] { return client.isDisconnected(); },
+                        &*server, {&client}));
+  EXPECT_TRUE(pumpUntil([&] { return server->stats().tlsHandshakeErrors == 1; },
+                        &*server, {}));
+  EXPECT_TRUE(connects.empty());
+}
+
+}  // namespace
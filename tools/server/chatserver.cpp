@@ -9,11 +9,11 @@
 #include "Server.h"
 
 #include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
-#include <unistd.h>
 #include <vector>
 
 
@@ -64,16 +64,6 @@ processMessages(Server& server, const std::deque<Message>& incoming) {
 }
 
 
-std::deque<Message>
-buildOutgoing(const std::string& log) {
-  std::deque<Message> outgoing;
-  for (auto client : clients) {
-    outgoing.push_back({client, log});
-  }
-  return outgoing;
-}
-
-
 std::string
 getHTTPMessage(const char* htmlLocation) {
   if (access(htmlLocation, R_OK ) != -1) {
@@ -103,7 +93,7 @@ main(int argc, char* argv[]) {
   while (true) {
     bool errorWhileUpdating = false;
     try {
-      server.update();
+      server.update(std::chrono::seconds{1});
     } catch (std::exception& e) {
       std::cerr << "Exception from Server update:\n"
                 << " " << e.what() << "\n\n";
@@ -111,15 +101,12 @@ main(int argc, char* argv[]) {
     }
 
     const auto incoming = server.receive();
-    const auto [log, shouldQuit] = processMessages(server, incoming);
-    const auto outgoing = buildOutgoing(log);
-    server.send(outgoing);
+    auto [log, shouldQuit] = processMessages(server, incoming);
+    server.broadcast(std::move(log), clients);
 
     if (shouldQuit || errorWhileUpdating) {
       break;
     }
-
-    sleep(1);
   }
 
   return 0;